@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+"""Compares two reports of the benchmark guest (see Makefile).
+
+    ./compare.py baseline.txt bench.txt
+"""
+
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 2 or fields[0] != "bench" or "=" in fields[1]:
+                continue
+            values = dict(kv.split("=", 1) for kv in fields[2:] if "=" in kv)
+            if "avg" in values:
+                results[fields[1]] = (int(values["avg"]), values.get("unit", ""))
+    return results
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    base = load(sys.argv[1])
+    cur = load(sys.argv[2])
+    print("%-12s %12s %12s %8s %s" % ("bench", "baseline", "current", "change", "unit"))
+    for name in cur:
+        avg, unit = cur[name]
+        if name not in base or base[name][0] == 0:
+            print("%-12s %12s %12d %8s %s" % (name, "-", avg, "-", unit))
+            continue
+        change = 100.0 * (avg - base[name][0]) / base[name][0]
+        print("%-12s %12d %12d %+7.1f%% %s" % (name, base[name][0], avg, change, unit))
+
+
+if __name__ == "__main__":
+    main()
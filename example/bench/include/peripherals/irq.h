@@ -0,0 +1,12 @@
+#ifndef	_P_IRQ_H
+#define	_P_IRQ_H
+
+#include "peripherals/base.h"
+
+#define ENABLE_IRQS_1		(PBASE+0x0000B210)
+#define DISABLE_IRQS_1		(PBASE+0x0000B21C)
+#define DISABLE_BASIC_IRQS	(PBASE+0x0000B224)
+
+#define SYSTEM_TIMER_IRQ_1	(1 << 1)
+
+#endif  /*_P_IRQ_H */
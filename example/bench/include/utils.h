@@ -0,0 +1,15 @@
+#ifndef	_BOOT_H
+#define	_BOOT_H
+
+extern void delay ( unsigned long);
+extern void put32 ( unsigned long, unsigned int );
+extern unsigned int get32 ( unsigned long );
+extern int get_el ( void );
+extern unsigned long get_cntvct ( void );
+extern unsigned long get_cntfrq ( void );
+extern unsigned long psci_version ( void );
+extern unsigned long get_id_aa64pfr0 ( void );
+extern void wait_for_event ( void );
+extern void wait_for_interrupt ( void );
+
+#endif  /*_BOOT_H */
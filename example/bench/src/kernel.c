@@ -0,0 +1,174 @@
+#include "printf.h"
+#include "utils.h"
+#include "mini_uart.h"
+#include "peripherals/timer.h"
+#include "peripherals/irq.h"
+
+// Measures the cost of the exits handled by the hypervisor and prints
+// one line per benchmark:
+//   bench <name> iters=<n> min=<v> avg=<v> max=<v> unit=<ns|us|B/s>
+
+#define ITERS		1000
+#define FAULT_ITERS	16
+#define FAULT_BASE	0x1000000	// above the image and the stack
+#define FAULT_STRIDE	0x200000	// a new block for every touch
+#define WFI_ITERS	100
+#define WFI_DELAY	100		// us of the system timer
+#define UART_BYTES	4096
+
+struct result {
+	unsigned long min;
+	unsigned long max;
+	unsigned long total;
+	int iters;
+};
+
+static unsigned long freq;
+
+static void reset_result(struct result *r)
+{
+	r->min = ~0UL;
+	r->max = 0;
+	r->total = 0;
+	r->iters = 0;
+}
+
+static void add_sample(struct result *r, unsigned long v)
+{
+	if (v < r->min)
+		r->min = v;
+	if (v > r->max)
+		r->max = v;
+	r->total += v;
+	r->iters++;
+}
+
+static unsigned long to_ns(unsigned long cycles)
+{
+	return cycles * 1000000000UL / freq;
+}
+
+static void report(const char *name, struct result *r, int cycles)
+{
+	unsigned long min = r->min, avg = r->total / r->iters, max = r->max;
+	if (cycles) {
+		min = to_ns(min);
+		avg = to_ns(avg);
+		max = to_ns(max);
+	}
+	printf("bench %s iters=%d min=%d avg=%d max=%d unit=%s\r\n", name,
+	       r->iters, (int)min, (int)avg, (int)max, cycles ? "ns" : "us");
+}
+
+// times op() with the virtual counter
+static void run(const char *name, void (*op)(void), int iters)
+{
+	struct result r;
+	reset_result(&r);
+	for (int i = 0; i < iters; i++) {
+		unsigned long t0 = get_cntvct();
+		op();
+		unsigned long t1 = get_cntvct();
+		add_sample(&r, t1 - t0);
+	}
+	report(name, &r, 1);
+}
+
+static void nop(void)
+{
+}
+
+static void hvc(void)
+{
+	psci_version();
+}
+
+static void mmio_read(void)
+{
+	get32(TIMER_CLO);
+}
+
+static void mmio_write(void)
+{
+	put32(DISABLE_BASIC_IRQS, 0);
+}
+
+static void sysreg_read(void)
+{
+	get_id_aa64pfr0();
+}
+
+// WFE is trapped and makes the vCPU yield its CPU
+static void wfe_yield(void)
+{
+	wait_for_event();
+}
+
+// stage 2 faults on the first touch of each block
+static void bench_page_fault(void)
+{
+	struct result r;
+	reset_result(&r);
+	for (int i = 0; i < FAULT_ITERS; i++) {
+		volatile unsigned long *p =
+			(unsigned long *)(FAULT_BASE + (unsigned long)i * FAULT_STRIDE);
+		unsigned long t0 = get_cntvct();
+		*p = i;
+		unsigned long t1 = get_cntvct();
+		add_sample(&r, t1 - t0);
+	}
+	report("page_fault", &r, 1);
+}
+
+// delay from the system timer match until the vCPU blocked in WFI runs
+// again (IRQs stay masked, WFI returns on the pending interrupt)
+static void bench_wfi_wakeup(void)
+{
+	struct result r;
+	reset_result(&r);
+	put32(ENABLE_IRQS_1, SYSTEM_TIMER_IRQ_1);
+	for (int i = 0; i < WFI_ITERS; i++) {
+		put32(TIMER_CS, TIMER_CS_M1);
+		unsigned int deadline = get32(TIMER_CLO) + WFI_DELAY;
+		put32(TIMER_C1, deadline);
+		while (!(get32(TIMER_CS) & TIMER_CS_M1))
+			wait_for_interrupt();
+		add_sample(&r, get32(TIMER_CLO) - deadline);
+	}
+	put32(TIMER_CS, TIMER_CS_M1);
+	put32(DISABLE_IRQS_1, SYSTEM_TIMER_IRQ_1);
+	report("wfi_wakeup", &r, 0);
+}
+
+// every character is an MMIO write (and a status read)
+static void bench_uart(void)
+{
+	unsigned long t0 = get_cntvct();
+	for (int i = 0; i < UART_BYTES; i++)
+		uart_send(i % 64 == 63 ? '\n' : '.');
+	unsigned long cycles = get_cntvct() - t0;
+	printf("\r\nbench uart_tx iters=%d min=0 avg=%d max=0 unit=B/s\r\n",
+	       UART_BYTES, (int)(UART_BYTES * freq / cycles));
+}
+
+void kernel_main(void)
+{
+	uart_init();
+	init_printf(0, putc);
+	freq = get_cntfrq();
+	printf("bench begin freq=%d\r\n", (int)freq);
+
+	run("counter", nop, ITERS);
+	run("hvc", hvc, ITERS);
+	run("mmio_read", mmio_read, ITERS);
+	run("mmio_write", mmio_write, ITERS);
+	run("sysreg_read", sysreg_read, ITERS);
+	run("wfe_yield", wfe_yield, ITERS);
+	bench_page_fault();
+	bench_wfi_wakeup();
+	bench_uart();
+
+	printf("bench end\r\n");
+	while (1)
+		wait_for_interrupt();
+}
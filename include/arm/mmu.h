@@ -20,7 +20,11 @@
 #define MT_NORMAL_CACHEABLE        0x1
 
 #define MT_DEVICE_nGnRnE_FLAGS     0x00
-#define MT_NORMAL_CACHEABLE_FLAGS  0x44  //TODO: temp. non-cacheable
+#ifdef CONFIG_NO_CACHE
+#define MT_NORMAL_CACHEABLE_FLAGS  0x44  // non-cacheable
+#else
+#define MT_NORMAL_CACHEABLE_FLAGS  0xff  // write-back, read/write-allocate
+#endif
 
 #define MAIR_VALUE                                                             \
   (MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) |                         \
@@ -35,17 +39,30 @@
 #define MM_STAGE2_ACCESS   (1 << 10)
 #define MM_STAGE2_SH       (3 << 8)
 #define MM_STAGE2_AP       (3 << 6)
-#define MM_STAGE2_MEMATTR  (0x5 << 2)  //TODO: temp. non-cacheable
+#ifdef CONFIG_NO_CACHE
+#define MM_STAGE2_MEMATTR  (0x5 << 2)  // normal, non-cacheable
+#else
+#define MM_STAGE2_MEMATTR  (0xf << 2)  // normal, write-back cacheable
+#endif
 
 #define MMU_STAGE2_PAGE_FLAGS                                                  \
   (MM_TYPE_PAGE | MM_STAGE2_ACCESS | MM_STAGE2_SH | MM_STAGE2_AP | MM_STAGE2_MEMATTR)
 
+#define MMU_STAGE2_BLOCK_FLAGS                                                 \
+  (MM_TYPE_BLOCK | MM_STAGE2_ACCESS | MM_STAGE2_SH | MM_STAGE2_AP | MM_STAGE2_MEMATTR)
+
 #define MM_STAGE2_AP_NONE  (0 << 6)
 #define MM_STAGE2_DEVICE_MEMATTR  (0x0 << 2)
 #define MMU_STAGE2_MMIO_PAGE_FLAGS                                             \
   (MM_TYPE_PAGE | MM_STAGE2_ACCESS | MM_STAGE2_SH | MM_STAGE2_AP_NONE | MM_STAGE2_DEVICE_MEMATTR)
 
 
+#define TCR_RESERVED ((1 << 31) | (1 << 23))
 #define TCR_T0SZ    (64 - 48)
 #define TCR_TG0_4K  (0 << 14)
-#define TCR_VALUE   (TCR_T0SZ | TCR_TG0_4K)
+#ifdef CONFIG_NO_CACHE
+#define TCR_CACHE   0
+#else
+#define TCR_CACHE   ((3 << 12) | (1 << 10) | (1 << 8)) // inner shareable, WBWA walks
+#endif
+#define TCR_VALUE   (TCR_RESERVED | TCR_T0SZ | TCR_TG0_4K | TCR_CACHE)
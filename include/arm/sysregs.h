@@ -4,15 +4,36 @@
 // SCTLR_EL2, System Control Register (EL2)
 // ***************************************
 
+#define SCTLR_RESERVED                                                         \
+  ((3 << 28) | (3 << 22) | (1 << 18) | (1 << 16) | (1 << 11) | (3 << 4))
 #define SCTLR_EE               (0 << 25)
 #define SCTLR_I_CACHE_DISABLED (0 << 12)
+#define SCTLR_I_CACHE_ENABLED  (1 << 12)
 #define SCTLR_D_CACHE_DISABLED (0 << 2)
+#define SCTLR_D_CACHE_ENABLED  (1 << 2)
 #define SCTLR_MMU_DISABLED     (0 << 0)
 #define SCTLR_MMU_ENABLED      (1 << 0)
 
 #define SCTLR_VALUE_MMU_DISABLED                                               \
-  (SCTLR_EE | SCTLR_I_CACHE_DISABLED | SCTLR_D_CACHE_DISABLED |                \
-   SCTLR_MMU_DISABLED)
+  (SCTLR_RESERVED | SCTLR_EE | SCTLR_I_CACHE_DISABLED |                        \
+   SCTLR_D_CACHE_DISABLED | SCTLR_MMU_DISABLED)
+
+// build with CACHE=off to compare against the uncached configuration
+#ifdef CONFIG_NO_CACHE
+#define SCTLR_VALUE_MMU_ENABLED                                                \
+  (SCTLR_RESERVED | SCTLR_EE | SCTLR_I_CACHE_DISABLED |                        \
+   SCTLR_D_CACHE_DISABLED | SCTLR_MMU_ENABLED)
+#else
+#define SCTLR_VALUE_MMU_ENABLED                                                \
+  (SCTLR_RESERVED | SCTLR_EE | SCTLR_I_CACHE_ENABLED |                         \
+   SCTLR_D_CACHE_ENABLED | SCTLR_MMU_ENABLED)
+#endif
+
+// ***************************************
+// CPUECTLR_EL1, CPU Extended Control Register (Cortex-A53)
+// ***************************************
+
+#define CPUECTLR_SMPEN (1 << 6) // enable hardware coherency
 
 // ***************************************
 // HCR_EL2, Hypervisor Configuration Register (EL2)
@@ -20,6 +41,7 @@
 
 // trap related
 #define HCR_TACR    (1 << 21)
+#define HCR_TSC     (1 << 19)
 #define HCR_TID3    (1 << 18)
 #define HCR_TID2    (1 << 17)
 #define HCR_TID1    (1 << 16)
@@ -36,10 +58,34 @@
 #define HCR_VM      (1 << 0) // stage 2 translation enable
 
 #define HCR_VALUE  \
-   ( HCR_TACR | HCR_TID3 | HCR_TID2 | HCR_TID1 |  \
+   ( HCR_TACR | HCR_TSC | HCR_TID3 | HCR_TID2 | HCR_TID1 |  \
    HCR_TWE | HCR_TWI | HCR_E2H | HCR_RW | HCR_TGE | HCR_AMO |  \
    HCR_IMO | HCR_FMO | HCR_SWIO | HCR_VM)
 
+// ***************************************
+// CPTR_EL2, Architectural Feature Trap Register (EL2)
+// ***************************************
+
+#define CPTR_RESERVED ((3 << 12) | 0x3ff)
+#define CPTR_TFP      (1 << 10) // trap FP/SIMD access
+
+#define CPTR_VALUE    (CPTR_RESERVED | CPTR_TFP)
+
+// ***************************************
+// MDCR_EL2, Monitor Debug Configuration Register (EL2)
+// ***************************************
+
+#define MDCR_TPM       (1 << 6) // trap PMU register access
+#define MDCR_HPMN_MASK 0x1f     // event counters accessible from EL1/EL0
+
+// ***************************************
+// PMCR_EL0, Performance Monitors Control Register
+// ***************************************
+
+#define PMCR_E       (1 << 0)
+#define PMCR_N_SHIFT 11 // number of event counters
+#define PMCR_N_MASK  0x1f
+
 // SCR_EL3, Secure Configuration Register (EL3)
 // ***************************************
 
@@ -69,10 +115,22 @@
 #define VTCR_PS    (2 << 16)
 #define VTCR_TG0   (0 << 14) // 4KB
 #define VTCR_SH0   (3 << 12)
+#ifdef CONFIG_NO_CACHE
 #define VTCR_ORGN0 (0 << 10)
 #define VTCR_IRGN0 (0 << 8)
+#else
+#define VTCR_ORGN0 (1 << 10) // write-back, write-allocate
+#define VTCR_IRGN0 (1 << 8)  // write-back, write-allocate
+#endif
 #define VTCR_SL0   (1 << 6)
 #define VTCR_T0SZ  (64 - 38)
 
 #define VTCR_VALUE                                                             \
   (VTCR_NSA | VTCR_NSW | VTCR_VS | VTCR_PS | VTCR_TG0 | VTCR_SH0 | VTCR_ORGN0 | VTCR_IRGN0 | VTCR_SL0 | VTCR_T0SZ)
+
+// ***************************************
+// ISR_EL1, Interrupt Status Register
+// ***************************************
+
+#define ISR_I (1 << 7) // physical IRQ pending
+#define ISR_F (1 << 6) // physical FIQ pending
@@ -0,0 +1,21 @@
+#pragma once
+
+// timestamped phases of the boot, up to the first guest instruction of
+// each VM (see boot_prof.c)
+#define BOOT_PHASES  64
+#define BOOT_NO_VM   0 // VMID 0 is not used
+
+struct boot_phase {
+  const char *name;
+  int vmid;            // BOOT_NO_VM for the hypervisor
+  unsigned long begin; // physical counter
+  unsigned long end;   // == begin for a point in time
+  unsigned long bytes; // for the throughput, 0 if none
+};
+
+void boot_prof_start(void);
+int boot_phase_begin(const char *, int);
+void boot_phase_end(int, unsigned long);
+void boot_prof_guest_started(int);
+void boot_prof_finish(void);
+void show_boot_phases(void);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "spinlock.h"
+
+// per-VM counts of synchronous exits by guest instruction (see exit_site.c)
+#define EXIT_SITE_SLOTS_SHIFT 10
+#define EXIT_SITE_SLOTS       (1 << EXIT_SITE_SLOTS_SHIFT)
+#define EXIT_SITE_ORDER       3 // pages of the table of a VM
+#define EXIT_SITE_MAX_PROBES  16
+#define EXIT_SITE_TOP         16 // entries shown per VM
+
+struct exit_site {
+  unsigned long elr; // guest PC of the trapped instruction
+  unsigned long ipa; // page of the abort, 0 for other exits
+  unsigned int count; // 0: free slot
+  unsigned int ec;    // ESR_EL2.EC
+};
+
+// hash table keyed by (elr, ec, ipa)
+struct exit_sites {
+  spinlock_t lock;
+  unsigned long nr_exits;
+  unsigned long dropped; // no free slot within EXIT_SITE_MAX_PROBES
+  struct exit_site slots[EXIT_SITE_SLOTS];
+};
+
+extern volatile int exit_sites_enabled;
+
+int enable_exit_sites(void);
+void disable_exit_sites(void);
+void exit_site_record(unsigned long, int, unsigned long);
+void show_exit_sites(void);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "mm.h"
+
+// exit reasons are ESR_EL2.EC of synchronous exceptions, and IRQ
+#define EXIT_REASON_IRQ 64
+#define NR_EXIT_REASONS 65
+
+#define NR_EXIT_BUCKETS 32 // log2 of physical counter cycles
+
+struct exit_hist {
+  unsigned long count;
+  unsigned long min;
+  unsigned long max;
+  unsigned long total;
+  // time spent in each phase of the exit
+  unsigned long leave_total;  // vm_leaving_work()
+  unsigned long handle_total; // exception handler
+  unsigned long enter_total;  // vm_entering_work()
+  unsigned long buckets[NR_EXIT_BUCKETS];
+};
+
+// per vCPU, too large for the task page
+struct exit_stats {
+  struct exit_hist reasons[NR_EXIT_REASONS];
+};
+
+#define EXIT_STATS_ORDER 3
+
+struct exit_stats *allocate_exit_stats(void);
+void exit_stat_leaving(unsigned long, unsigned long);
+void exit_stat_set_sync(unsigned long, unsigned long);
+void exit_stat_set_mmio(unsigned long);
+void exit_stat_switch(struct task_struct *);
+void exit_stat_entering(unsigned long, unsigned long);
+void show_exit_stats(void);
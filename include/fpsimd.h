@@ -0,0 +1,11 @@
+#pragma once
+
+#include "sched.h"
+
+void fpsimd_switch_to(struct task_struct *, struct task_struct *);
+void handle_trap_fpsimd(void);
+
+extern void fpsimd_save(struct fpsimd_state *);
+extern void fpsimd_restore(struct fpsimd_state *);
+extern void enable_fpsimd_trap(void);
+extern void disable_fpsimd_trap(void);
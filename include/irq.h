@@ -1,6 +1,7 @@
 #pragma once
 
 void enable_interrupt_controller(void);
+void enable_local_interrupts(int);
 
 void irq_vector_init(void);
 void enable_irq(void);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+// circular doubly linked list (embedded in the containing struct)
+struct list_head {
+  struct list_head *next;
+  struct list_head *prev;
+};
+
+#define container_of(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define list_first_entry(head, type, member) \
+  container_of((head)->next, type, member)
+
+static inline void init_list_head(struct list_head *head) {
+  head->next = head;
+  head->prev = head;
+}
+
+static inline int list_empty(const struct list_head *head) {
+  return head->next == head;
+}
+
+static inline void list_add_tail(struct list_head *entry,
+                                 struct list_head *head) {
+  entry->prev = head->prev;
+  entry->next = head;
+  head->prev->next = entry;
+  head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry) {
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  entry->next = entry;
+  entry->prev = entry;
+}
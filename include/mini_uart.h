@@ -4,4 +4,5 @@ void uart_init(void);
 void handle_uart_irq(void);
 char uart_recv(void);
 void uart_send(char c);
+void uart_send_raw(char c);
 void putc(void *p, char c);
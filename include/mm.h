@@ -31,6 +31,22 @@
 
 #define PG_DIR_SIZE (3 * PAGE_SIZE)
 
+// buddy allocator handles blocks of 2^0 .. 2^(MAX_ORDER-1) pages
+#define MAX_ORDER 11
+
+// stage 2 block mapping policy (per VM)
+#define STAGE2_BLOCK_NEVER        0
+#define STAGE2_BLOCK_ON_THRESHOLD 1 // when enough pages in the region are mapped
+#define STAGE2_BLOCK_ALWAYS       2
+#define STAGE2_BLOCK_DEFAULT_THRESHOLD 64
+
+#define FAULT_AROUND_DEFAULT_PAGES 16
+
+// pre-zeroed page pool (in pages)
+#define ZERO_POOL_LOW   64
+#define ZERO_POOL_HIGH  256
+#define ZERO_POOL_BATCH 16
+
 #ifndef __ASSEMBLER__
 
 #include "sched.h"
@@ -42,15 +58,29 @@ typedef uint64_t vaddr_t;
 #define TO_VADDR(pa) ((vaddr_t)pa + VA_START)
 #define TO_PADDR(pa) ((paddr_t)pa - VA_START)
 
-void map_stage2_page(struct task_struct *task, vaddr_t va,
+void map_stage2_page(struct vm_struct *vm, vaddr_t va,
                      paddr_t page, uint64_t flags);
-
+void set_stage2_block_policy(struct vm_struct *vm, int policy,
+                             int threshold);
+void set_stage2_fault_around(struct vm_struct *vm, int pages);
+void set_stage2_prefault(struct vm_struct *vm, unsigned long size);
+int prefault_stage2(struct vm_struct *vm);
+void free_stage2_tables(struct vm_struct *vm);
+
+void mm_init(void);
+paddr_t get_free_pages(int order);
+void free_pages(paddr_t);
+paddr_t get_free_page(void);
+void free_page(paddr_t);
+int refill_zero_pool(void);
 void *allocate_page(void);
+void *allocate_pages(int order);
 void deallocate_page(void *);
 void *allocate_task_page(struct task_struct *task, vaddr_t va);
 void set_task_page_notaccessable(struct task_struct *task, vaddr_t va);
 
 int handle_mem_abort(vaddr_t addr, uint64_t esr);
+void show_free_area_info(void);
 
 extern paddr_t pg_dir;
 
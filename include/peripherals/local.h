@@ -0,0 +1,24 @@
+#pragma once
+
+#include "mm.h"
+
+// BCM2836 local peripherals (per-core timers, mailboxes and interrupt routing)
+#define LOCAL_PERIPHERALS_BASE 0x40000000
+#define LPBASE (VA_START + LOCAL_PERIPHERALS_BASE)
+
+#define CORE_PMU_IRQ_SET        (LPBASE + 0x10)
+#define CORE_PMU_IRQ_CLR        (LPBASE + 0x14)
+#define CORE_TIMER_IRQCNTL(cpu) (LPBASE + 0x40 + 4 * (cpu))
+#define CORE_MBOX_IRQCNTL(cpu)  (LPBASE + 0x50 + 4 * (cpu))
+#define CORE_IRQ_SOURCE(cpu)    (LPBASE + 0x60 + 4 * (cpu))
+#define CORE_MBOX0_SET(cpu)     (LPBASE + 0x80 + 0x10 * (cpu))
+#define CORE_MBOX0_RDCLR(cpu)   (LPBASE + 0xC0 + 0x10 * (cpu))
+
+#define CORE_TIMER_CNTHP (1 << 2) // EL2 physical timer
+#define CORE_MBOX0       (1 << 0)
+
+// bits of CORE_IRQ_SOURCE
+#define CORE_IRQ_CNTHP   (1 << 2)
+#define CORE_IRQ_MAILBOX0 (1 << 4)
+#define CORE_IRQ_GPU     (1 << 8)
+#define CORE_IRQ_PMU     (1 << 9)
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "sched.h"
+
+#define PMU_MAX_COUNTERS 31 // event counters (PMCR_EL0.N of the CPU is used)
+
+// PMU registers of a vCPU (see pmu.c)
+struct pmu_state {
+  unsigned long pmcr;
+  unsigned long pmcntenset;
+  unsigned long pmintenset;
+  unsigned long pmovsset;
+  unsigned long pmselr;
+  unsigned long pmuserenr;
+  unsigned long pmccntr;
+  unsigned long pmccfiltr;
+  unsigned long pmevcntr[PMU_MAX_COUNTERS];
+  unsigned long pmevtyper[PMU_MAX_COUNTERS];
+};
+
+void pmu_init(void);
+void pmu_switch_to(struct task_struct *, struct task_struct *);
+int is_pmu_sysreg(unsigned long);
+void handle_trap_pmu(unsigned long);
+void handle_pmu_irq(void);
+int pmu_irq_pending(struct task_struct *);
@@ -95,6 +95,8 @@ regs Kusti, 23.10.2004
 void init_printf(void *putp, void (*putf)(void *, char));
 
 void tfp_printf(char *fmt, ...);
+unsigned long lock_stdout(void);
+void unlock_stdout(unsigned long);
 void tfp_sprintf(char *s, char *fmt, ...);
 
 void tfp_format(void *putp, void (*putf)(void *, char), char *fmt, va_list va);
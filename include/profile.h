@@ -0,0 +1,30 @@
+#pragma once
+
+#include "spinlock.h"
+
+// sampling profiler of guest PCs (see profile.c)
+#define PROFILE_SLOTS_SHIFT 12
+#define PROFILE_SLOTS      (1 << PROFILE_SLOTS_SHIFT)
+#define PROFILE_ORDER      5    // pages of the histogram of a VM
+#define PROFILE_MAX_PROBES 16
+
+struct prof_sample {
+  unsigned long pc;
+  unsigned long elr; // ELR_EL1 of the last sample taken at EL1
+  unsigned int count; // 0: free slot
+  unsigned int el;
+};
+
+// hash histogram of the samples of a VM, keyed by (pc, el)
+struct vm_profile {
+  spinlock_t lock;
+  unsigned long nr_samples;
+  unsigned long dropped; // no free slot within PROFILE_MAX_PROBES
+  struct prof_sample slots[PROFILE_SLOTS];
+};
+
+extern volatile int profile_enabled;
+
+int set_profile_period(int);
+void profile_tick(void);
+void dump_profile(void);
@@ -0,0 +1,29 @@
+#pragma once
+
+// PSCI function IDs (SMC32 / SMC64 calling convention)
+#define PSCI_0_2_FN_BASE        0x84000000
+#define PSCI_0_2_64BIT          0x40000000
+#define PSCI_0_2_FN(n)          (PSCI_0_2_FN_BASE + (n))
+#define PSCI_0_2_FN64(n)        (PSCI_0_2_FN_BASE + PSCI_0_2_64BIT + (n))
+
+#define PSCI_VERSION            PSCI_0_2_FN(0)
+#define PSCI_CPU_OFF            PSCI_0_2_FN(2)
+#define PSCI_CPU_ON             PSCI_0_2_FN(3)
+#define PSCI_CPU_ON64           PSCI_0_2_FN64(3)
+#define PSCI_AFFINITY_INFO      PSCI_0_2_FN(4)
+#define PSCI_AFFINITY_INFO64    PSCI_0_2_FN64(4)
+#define PSCI_MIGRATE_INFO_TYPE  PSCI_0_2_FN(6)
+#define PSCI_FEATURES           PSCI_0_2_FN(10)
+
+#define PSCI_RET_SUCCESS            0
+#define PSCI_RET_NOT_SUPPORTED      -1
+#define PSCI_RET_INVALID_PARAMETERS -2
+#define PSCI_RET_ALREADY_ON         -4
+
+#define PSCI_AFFINITY_ON  0
+#define PSCI_AFFINITY_OFF 1
+
+#define PSCI_TOS_NOT_PRESENT_MP 2
+
+int is_psci_call(unsigned long);
+void handle_psci_call(void);
@@ -4,19 +4,45 @@
 
 #ifndef __ASSEMBLER__
 
+#include "list.h"
+#include "spinlock.h"
+#include "smp.h"
+
 #define THREAD_SIZE 4096
 
 #define NR_TASKS 64
+#define NR_VMS   16
+#define NR_VCPUS 4  // per VM
 
 #define FIRST_TASK task[0]
 #define LAST_TASK task[NR_TASKS - 1]
 
 #define TASK_RUNNING 0
 #define TASK_ZOMBIE 1
+#define TASK_BLOCKED 2 // waiting in WFI for a virtual interrupt
+#define TASK_STOPPED 3 // vCPU not started by PSCI CPU_ON (or CPU_OFF)
+
+// credit levels (runqueue priorities, the highest runs first)
+#define SCHED_PRIO_OVER  0 // the VM used up its credit
+#define SCHED_PRIO_UNDER 1
+#define SCHED_PRIO_BOOST 2 // woken up by a virtual interrupt, until the next tick
+#define NR_PRIO 3
+
+#define SCHED_TICK        10000 // us
+#define SCHED_ACCT_PERIOD 30000 // us, credit is distributed every period
+
+#define SCHED_DEFAULT_WEIGHT    256
+#define SCHED_MIN_WEIGHT        1
+#define SCHED_MAX_WEIGHT        65535
+#define SCHED_DEFAULT_TIMESLICE 30000 // us
 
 struct board_ops;
+struct prio_array;
+struct exit_stats;
+struct vm_profile;
+struct exit_sites;
+struct pmu_state;
 
-extern struct task_struct *current;
 extern struct task_struct *task[NR_TASKS];
 extern int nr_tasks;
 
@@ -52,8 +78,6 @@ struct cpu_sysregs {
 
   unsigned long cpacr_el1;
   unsigned long elr_el1;
-  unsigned long fpcr;
-  unsigned long fpsr;
   unsigned long midr_el1; // ro
   unsigned long mpidr_el1; // ro
   unsigned long par_el1;
@@ -116,10 +140,24 @@ struct cpu_sysregs {
 };
 
 
+// saved only when another VM uses FP/SIMD (see fpsimd.c)
+struct fpsimd_state {
+  unsigned long vregs[64]; // q0-q31
+  unsigned long fpcr;
+  unsigned long fpsr;
+};
+
 struct mm_struct {
   unsigned long first_table;
   int user_pages_count;
   int kernel_pages_count;
+  int block_policy;
+  int block_threshold;
+  int block_mappings_count; // 2MB blocks
+  int page_mappings_count;  // 4KB pages
+  int fault_around_pages;
+  unsigned long prefault_size;
+  spinlock_t page_table_lock; // the vCPUs fault concurrently
 };
 
 struct task_stat {
@@ -127,7 +165,10 @@ struct task_stat {
   long hvc_trap_count;
   long sysreg_trap_count;
   long pf_count;
+  long pf_avoided_count; // pages mapped before the first access
   long mmio_count;
+  unsigned long exit_cycles; // time spent in the hypervisor per exit
+  long exit_count;
 };
 
 struct task_console {
@@ -135,42 +176,119 @@ struct task_console {
   struct fifo *out_fifo;
 };
 
+// A VM owns the guest memory, the emulated board and the console.
+// Each of its vCPUs is a task_struct scheduled on its own.
+struct vm_struct {
+  int id; // used as VMID
+  const char *name;
+  const struct board_ops *board_ops;
+  void *board_data;
+  spinlock_t lock; // board state and vCPU power state
+  struct mm_struct mm;
+  struct task_console console;
+  int nr_vcpus;
+  struct task_struct *vcpus[NR_VCPUS];
+  int last_vcpu_ran[NR_CPUS]; // for TLB maintenance
+
+  // credit scheduler (see sched.c), times in physical counter cycles
+  int weight;
+  int cap;                 // percent of one CPU, 0: no cap
+  unsigned long timeslice; // us
+  long credit;
+  unsigned long period_runtime; // consumed since the last accounting
+  unsigned long cap_used;       // consumed and not covered by the cap yet
+  unsigned long runtime;        // consumed in total
+
+  // wake-to-run latency of the vCPUs woken up by virtual interrupts
+  unsigned long wakeup_count;
+  unsigned long wakeup_latency_total;
+  unsigned long wakeup_latency_max;
+
+  // halt polling on WFI (see sync_exc.c)
+  unsigned long halt_poll_success;
+  unsigned long halt_poll_fail;
+  unsigned long halt_poll_cycles; // time spent polling
+
+  struct vm_profile *profile; // sampled guest PCs (see profile.c)
+  struct exit_sites *exit_sites; // exits per guest instruction (see exit_site.c)
+};
+
 struct task_struct {
   struct cpu_context cpu_context;
   long state;
-  long counter;
-  long priority;
+  long prio; // credit level (SCHED_PRIO_*)
   long preempt_count;
-  long pid; // used as VMID
+  long pid;
   unsigned long flags;
-  const char *name;
-  const struct board_ops *board_ops;
-  void *board_data;
-  struct mm_struct mm;
+  struct vm_struct *vm; // NULL for the idle tasks
+  int vcpu_id;
   struct cpu_sysregs cpu_sysregs;
+  struct fpsimd_state *fpsimd;
+  struct pmu_state *pmu; // NULL until the vCPU uses the PMU (see pmu.c)
   struct task_stat stat;
-  struct task_console console;
+  struct exit_stats *exit_stats; // latency per exit reason (see exit_stat.c)
+  struct list_head run_list;
+  struct prio_array *array; // runqueue array, NULL if not queued
+  unsigned long wakeup_time; // physical timer count, 0 if none
+  unsigned long exec_start;  // physical counter when runtime was last charged
+  unsigned long slice_start; // physical counter when its timeslice began
+  unsigned long sum_exec_runtime;
+  unsigned long wakeup_start; // physical counter when it was woken up, 0 if not
+  unsigned long halt_poll_window; // physical counter cycles, 0: no polling
+  int throttled;   // parked by the cap of its VM
+  int boost;       // enqueued at SCHED_PRIO_BOOST if it has credit
+  int cpu;         // runqueue the task belongs to
+  int on_cpu;      // running, or its registers are not saved yet
+  int last_cpu;    // CPU the task was last loaded on (for TLB maintenance)
+  int sysregs_cpu; // CPU holding its EL1 registers (not saved yet), or -1
+  int fpsimd_cpu;  // CPU whose FP/SIMD registers were last loaded from it
 };
 
+#ifdef CONFIG_HOST
+// the host build (tools/host) simulates the CPUs
+struct task_struct *get_current(void);
+void set_current(struct task_struct *);
+#else
+// each CPU keeps the running task in TPIDR_EL2
+static inline struct task_struct *get_current(void) {
+  struct task_struct *p;
+  asm volatile("mrs %0, tpidr_el2" : "=r"(p));
+  return p;
+}
+
+static inline void set_current(struct task_struct *p) {
+  asm volatile("msr tpidr_el2, %0" : : "r"(p));
+}
+#endif
+
+#define current get_current()
+
 extern void sched_init(void);
+extern void init_idle_task(int);
+extern int set_vm_sched_params(struct vm_struct *, int, int, unsigned long);
+extern int need_sched_tick(void);
+extern void wake_up_new_task(struct task_struct *);
+extern void enqueue_task(struct task_struct *);
+extern void dequeue_task(struct task_struct *);
+extern int nr_running_tasks(void);
+extern int has_pending_interrupt(struct task_struct *);
+extern void block_current_task(unsigned long);
+extern void wake_up_task(struct task_struct *);
+extern void wake_up_expired_tasks(unsigned long);
+extern void check_preempt_wakeup(void);
+extern unsigned long earliest_wakeup_time(void);
 extern void schedule(void);
+extern void _schedule(void);
 extern void timer_tick(void);
 extern void preempt_disable(void);
 extern void preempt_enable(void);
 extern void set_cpu_virtual_interrupt(struct task_struct *);
 void set_cpu_sysregs(struct task_struct *);
+extern void put_cpu_sysregs(struct task_struct *);
 extern void switch_to(struct task_struct *);
-extern void cpu_switch_to(struct task_struct *, struct task_struct *);
+extern struct task_struct *cpu_switch_to(struct task_struct *, struct task_struct *);
+extern void schedule_tail(struct task_struct *);
 extern void exit_task(void);
 extern void show_task_list(void);
 
-#define INIT_TASK  \
-  {  \
-    /* cpu_context */ {0}, \
-    /* state etc */    0, 0, 1, 0, 0, 0, "", 0, 0,  \
-    /* mm */          {0},  \
-    /* cpu_sysregs */ {0},  \
-    /* stat */        {0},  \
-    /* console */     {0},  \
-  }
 #endif
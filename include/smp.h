@@ -0,0 +1,29 @@
+#pragma once
+
+#define NR_CPUS 4
+
+// stack of the idle task of each CPU (CPU n: LOW_MEMORY - n * CPU_STACK_SIZE)
+#define CPU_STACK_SIZE 0x10000
+
+#ifndef __ASSEMBLER__
+
+#ifdef CONFIG_HOST
+int smp_processor_id(void);
+#else
+static inline int smp_processor_id(void) {
+  unsigned long mpidr;
+  asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+  return mpidr & 0xff;
+}
+#endif
+
+void smp_boot_secondaries(void);
+void set_cpu_online(int);
+int is_cpu_online(int);
+void send_ipi(int);
+void handle_ipi(void);
+
+extern unsigned long spin_table[NR_CPUS];
+extern void secondary_startup(void);
+
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+// test-and-set spinlock (see spinlock.S). The exclusive monitors only work
+// on cacheable memory, so locks must not be taken before the MMU is on.
+typedef struct {
+  volatile unsigned int locked;
+} spinlock_t;
+
+void spin_lock(spinlock_t *);
+void spin_unlock(spinlock_t *);
+unsigned long spin_lock_irqsave(spinlock_t *);
+void spin_unlock_irqrestore(spinlock_t *, unsigned long);
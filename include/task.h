@@ -15,13 +15,23 @@
 
 typedef int (*loader_func_t)(void *, unsigned long *, unsigned long *);
 
+struct vm_params {
+  int nr_vcpus;
+  int weight;                  // CPU share relative to the other VMs
+  int cap;                     // max CPU usage in percent of one CPU, 0: no cap
+  unsigned long timeslice;     // us
+  unsigned long prefault_size; // bytes mapped before the guest starts, 0: none
+};
+
 struct pt_regs *task_pt_regs(struct task_struct *);
-int create_task(loader_func_t, void *);
-void init_task_console(struct task_struct *);
-int is_uart_forwarded_task(struct task_struct *);
-void flush_task_console(struct task_struct *);
+int create_vm(loader_func_t, void *, const struct vm_params *);
+void reset_vcpu_sysregs(struct task_struct *);
+int is_uart_forwarded_vm(struct vm_struct *);
+void flush_vm_console(struct vm_struct *);
 void increment_current_pc(int);
-void init_initial_task(void);
+
+extern struct vm_struct *vms[NR_VMS];
+extern int nr_vms;
 
 struct pt_regs {
   unsigned long regs[31];
@@ -1,6 +1,12 @@
 #pragma once
 
 void timer_init(void);
-void handle_timer1_irq(void);
+void handle_sched_timer_irq(void);
+void update_sched_tick(int);
 void handle_timer3_irq(void);
 unsigned long get_physical_timer_count(void);
+unsigned long cntpct_to_ns(unsigned long);
+unsigned long cntpct_to_ms(unsigned long);
+unsigned long us_to_cntpct(unsigned long);
+void set_vm_timer(unsigned long);
+void update_wakeup_timer(void);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// per-CPU ring buffer of VM exits (see trace.c)
+#define TRACE_ENTRIES 1024
+#define TRACE_ORDER   4 // pages of the buffer of a CPU
+#define TRACE_DUMP_CHUNK 16 // entries per chunk sent by the idle loop
+#define TRACE_TICK_CHUNK 1  // and by the scheduler tick (about 6 ms)
+
+#define TRACE_RESULT_RESUMED  0 // returned to the same vCPU
+#define TRACE_RESULT_SWITCHED 1 // switched to another task (e.g. blocked in WFI)
+
+// 48 bytes, little endian (decoded by tools/decode_trace.py)
+struct trace_entry {
+  uint64_t timestamp; // physical counter at the exit
+  uint64_t elr;       // guest PC
+  uint64_t addr;      // IPA of instruction/data aborts, 0 otherwise
+  uint32_t esr;
+  uint32_t duration;  // counter cycles until the VM entry (or the switch)
+  uint16_t vmid;
+  uint8_t vcpu;
+  uint8_t cpu;
+  uint8_t reason;     // ESR_EL2.EC, or EXIT_REASON_IRQ
+  int8_t result;      // TRACE_RESULT_*
+  uint16_t reserved;
+  uint64_t value;     // data read or written by emulated MMIO, 0 otherwise
+} __attribute__((packed));
+
+#define TRACE_MAGIC       "RVTR"
+#define TRACE_CHUNK_MAGIC "RVTC"
+#define TRACE_END_MAGIC   "RVTE"
+#define TRACE_VERSION     3
+
+extern volatile int trace_enabled;
+
+int enable_trace(void);
+void disable_trace(void);
+void trace_exit(struct trace_entry *);
+void dump_trace(void);
+void run_trace_dump(void);
+void trace_dump_tick(void);
+int trace_dump_pending(void);
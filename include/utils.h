@@ -14,7 +14,19 @@ extern void delay(unsigned long);
 extern void put32(unsigned long, unsigned int);
 extern unsigned int get32(unsigned long);
 extern unsigned long get_el(void);
+extern void wait_for_interrupt(void);
 extern void set_stage2_pgd(unsigned long, unsigned long);
+extern void flush_guest_tlb(void);
+extern void flush_guest_tlb_local(void);
+extern void set_hyp_timer(unsigned long);
+extern void stop_hyp_timer(void);
+extern void flush_dcache_range(void *, unsigned long);
+extern void invalidate_icache(void);
+extern unsigned long get_cntpct(void);
+extern unsigned long get_cntfrq(void);
+extern unsigned long get_isr(void);
+extern unsigned long get_hpfar(void);
+extern unsigned long get_elr_el1(void);
 extern void restore_sysregs(struct cpu_sysregs *);
 extern void save_sysregs(struct cpu_sysregs *);
 extern void get_all_sysregs(struct cpu_sysregs *);
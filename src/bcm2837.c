@@ -6,6 +6,7 @@
 #include "fifo.h"
 #include "timer.h"
 #include "utils.h"
+#include "boot_prof.h"
 #include "peripherals/mini_uart.h"
 #include "peripherals/timer.h"
 #include "peripherals/irq.h"
@@ -86,20 +87,22 @@ void bcm2837_initialize(struct task_struct *tsk) {
 
   s->systimer.last_physical_count = get_physical_timer_count();
 
-  tsk->board_data = s;
+  tsk->vm->board_data = s;
 
+  int phase = boot_phase_begin("stage-2 mmio setup", tsk->vm->id);
   unsigned long begin = DEVICE_BASE;
   unsigned long end = PHYS_MEMORY_SIZE - SECTION_SIZE;
   for (; begin < end; begin += PAGE_SIZE) {
     set_task_page_notaccessable(tsk, begin);
   }
+  boot_phase_end(phase, 0);
 }
 
 unsigned long handle_aux_read(struct task_struct *, unsigned long);
 
 unsigned long handle_intctrl_read(struct task_struct *tsk, unsigned long addr) {
 #define BIT(v, n) ((v) & (1 << (n)))
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
   switch (addr) {
   case IRQ_BASIC_PENDING:
     {
@@ -140,7 +143,7 @@ unsigned long handle_intctrl_read(struct task_struct *tsk, unsigned long addr) {
 }
 
 void handle_intctrl_write(struct task_struct *tsk, unsigned long addr, unsigned long val) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
   switch (addr) {
   case FIQ_CONTROL:
     s->intctrl.fiq_control = val;
@@ -169,7 +172,7 @@ void handle_intctrl_write(struct task_struct *tsk, unsigned long addr, unsigned
 #define LCR_DLAB 0x80
 
 unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
 
   if ((s->aux.aux_enables & 1) == 0 && ADDR_IN_AUX_MU(addr)) {
     return 0;
@@ -190,7 +193,7 @@ unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
       return s->aux.aux_mu_baud & 0xff;
     } else {
       unsigned long data;
-      dequeue_fifo(tsk->console.in_fifo, &data);
+      dequeue_fifo(tsk->vm->console.in_fifo, &data);
       return data & 0xff;
     }
   case AUX_MU_IER_REG:
@@ -201,8 +204,8 @@ unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
     }
   case AUX_MU_IIR_REG:
     {
-      int tx_int = (s->aux.aux_mu_ier & 0x2) && is_empty_fifo(tsk->console.out_fifo);
-      int rx_int = (s->aux.aux_mu_ier & 0x1) && !is_empty_fifo(tsk->console.in_fifo);
+      int tx_int = (s->aux.aux_mu_ier & 0x2) && is_empty_fifo(tsk->vm->console.out_fifo);
+      int rx_int = (s->aux.aux_mu_ier & 0x1) && !is_empty_fifo(tsk->vm->console.in_fifo);
       int int_id = tx_int | (rx_int << 1);
       if (int_id == 0x3)
         int_id = 0x1;
@@ -214,10 +217,10 @@ unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
     return s->aux.aux_mu_mcr;
   case AUX_MU_LSR_REG:
     {
-      int dready = !is_empty_fifo(tsk->console.in_fifo);
+      int dready = !is_empty_fifo(tsk->vm->console.in_fifo);
       int rx_overrun = s->aux.mu_rx_overrun;
-      int tx_empty = !is_full_fifo(tsk->console.out_fifo);
-      int tx_idle = is_empty_fifo(tsk->console.out_fifo);
+      int tx_empty = !is_full_fifo(tsk->vm->console.out_fifo);
+      int tx_idle = is_empty_fifo(tsk->vm->console.out_fifo);
       s->aux.mu_rx_overrun = 0;
       return dready | (rx_overrun << 1) | (tx_empty << 5) | (tx_idle << 6);
     }
@@ -230,16 +233,16 @@ unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
   case AUX_MU_STAT_REG:
     {
 #define MIN(a,b) ((a)<(b)?(a):(b))
-      int sym_avail = !is_empty_fifo(tsk->console.in_fifo);
-      int space_avail = !is_full_fifo(tsk->console.out_fifo);
-      int rx_idle = is_empty_fifo(tsk->console.in_fifo);
-      int tx_idle = !is_empty_fifo(tsk->console.out_fifo);
+      int sym_avail = !is_empty_fifo(tsk->vm->console.in_fifo);
+      int space_avail = !is_full_fifo(tsk->vm->console.out_fifo);
+      int rx_idle = is_empty_fifo(tsk->vm->console.in_fifo);
+      int tx_idle = !is_empty_fifo(tsk->vm->console.out_fifo);
       int rx_overrun = s->aux.mu_rx_overrun;
       int tx_full = !space_avail;
-      int tx_empty = is_empty_fifo(tsk->console.out_fifo);
+      int tx_empty = is_empty_fifo(tsk->vm->console.out_fifo);
       int tx_done = rx_idle & tx_empty;
-      int rx_fifo_level = MIN(used_of_fifo(tsk->console.in_fifo), 8);
-      int tx_fifo_level = MIN(used_of_fifo(tsk->console.out_fifo), 8);
+      int rx_fifo_level = MIN(used_of_fifo(tsk->vm->console.in_fifo), 8);
+      int tx_fifo_level = MIN(used_of_fifo(tsk->vm->console.out_fifo), 8);
       return sym_avail | (space_avail << 1) | (rx_idle << 2) |
         (tx_idle << 3) | (rx_overrun << 4) | (tx_full << 5) |
         (tx_empty << 8) | (tx_done << 9) | (rx_fifo_level << 16) |
@@ -252,7 +255,7 @@ unsigned long handle_aux_read(struct task_struct *tsk, unsigned long addr) {
 }
 
 void handle_aux_write(struct task_struct *tsk, unsigned long addr, unsigned long val) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
 
   if ((s->aux.aux_enables & 1) == 0 && ADDR_IN_AUX_MU(addr)) {
     return;
@@ -268,7 +271,7 @@ void handle_aux_write(struct task_struct *tsk, unsigned long addr, unsigned long
       s->aux.aux_mu_baud =
         (s->aux.aux_mu_baud & 0xff00) | (val & 0xff);
     } else {
-      enqueue_fifo(tsk->console.out_fifo, val & 0xff);
+      enqueue_fifo(tsk->vm->console.out_fifo, val & 0xff);
     }
     break;
   case AUX_MU_IER_REG:
@@ -281,9 +284,9 @@ void handle_aux_write(struct task_struct *tsk, unsigned long addr, unsigned long
     break;
   case AUX_MU_IIR_REG:
     if (val & 0x2)
-      clear_fifo(tsk->console.in_fifo);
+      clear_fifo(tsk->vm->console.in_fifo);
     if (val & 0x4)
-      clear_fifo(tsk->console.out_fifo);
+      clear_fifo(tsk->vm->console.out_fifo);
     break;
   case AUX_MU_LCR_REG:
     s->aux.aux_mu_lcr = val;
@@ -307,7 +310,7 @@ void handle_aux_write(struct task_struct *tsk, unsigned long addr, unsigned long
 #define TO_PHYSICAL_COUNT(s, v) (v + (s)->systimer.offset)
 
 unsigned long handle_systimer_read(struct task_struct *tsk, unsigned long addr) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
   switch (addr) {
   case TIMER_CS:
     return s->systimer.cs;
@@ -328,7 +331,7 @@ unsigned long handle_systimer_read(struct task_struct *tsk, unsigned long addr)
 }
 
 void handle_systimer_write(struct task_struct *tsk, unsigned long addr, unsigned long val) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
   uint32_t current_clo = handle_systimer_read(tsk, TIMER_CLO);
   const uint32_t min_expire = 10000; // if this value is too short, CLO exceeds this value (timing problem)
 
@@ -389,8 +392,22 @@ static int check_expiration(uint32_t *expire, uint64_t lapse) {
   }
 }
 
+// remaining time until the nearest compare match, 0xffffffff if none
+static uint32_t upcoming_expiration(struct bcm2837_state *s) {
+  uint32_t upcoming = 0xffffffff;
+  if (s->systimer.c0_expire && upcoming > s->systimer.c0_expire)
+    upcoming = s->systimer.c0_expire;
+  if (s->systimer.c1_expire && upcoming > s->systimer.c1_expire)
+    upcoming = s->systimer.c1_expire;
+  if (s->systimer.c2_expire && upcoming > s->systimer.c2_expire)
+    upcoming = s->systimer.c2_expire;
+  if (s->systimer.c3_expire && upcoming > s->systimer.c3_expire)
+    upcoming = s->systimer.c3_expire;
+  return upcoming;
+}
+
 void bcm2837_entering_vm(struct task_struct *tsk) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
 
   // update systimer's offset
   unsigned long current_physical_count = get_physical_timer_count();
@@ -405,25 +422,18 @@ void bcm2837_entering_vm(struct task_struct *tsk) {
     (check_expiration(&s->systimer.c3_expire, lapse) << 3);
 
   // update (physical) timer compare value for upcoming timer match
-  uint32_t upcoming = 0xffffffff;
-  if (s->systimer.c0_expire && upcoming > s->systimer.c0_expire)
-    upcoming = s->systimer.c0_expire;
-  if (s->systimer.c1_expire && upcoming > s->systimer.c1_expire)
-    upcoming = s->systimer.c1_expire;
-  if (s->systimer.c2_expire && upcoming > s->systimer.c2_expire)
-    upcoming = s->systimer.c2_expire;
-  if (s->systimer.c3_expire && upcoming > s->systimer.c3_expire)
-    upcoming = s->systimer.c3_expire;
-
+  uint32_t upcoming = upcoming_expiration(s);
   if (upcoming != 0xffffffff)
-    put32(TIMER_C3, get32(TIMER_CLO) + upcoming);
+    set_vm_timer(current_physical_count + upcoming);
+  else
+    set_vm_timer(0);
 
   int fired = (~s->systimer.cs) & matched;
   s->systimer.cs |= fired;
 }
 
 void bcm2837_leaving_vm(struct task_struct *tsk) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
   s->systimer.last_physical_count = get_physical_timer_count();
 }
 
@@ -432,7 +442,7 @@ int bcm2837_is_irq_asserted(struct task_struct *tsk) {
 }
 
 int bcm2837_is_fiq_asserted(struct task_struct *tsk) {
-  struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
 
   if ((s->intctrl.fiq_control & 0x80) == 0)
     return 0;
@@ -452,6 +462,15 @@ int bcm2837_is_fiq_asserted(struct task_struct *tsk) {
   return 0;
 }
 
+// physical counter value of the next compare match (used to wake up the VM)
+unsigned long bcm2837_next_timer_event(struct task_struct *tsk) {
+  struct bcm2837_state *s = (struct bcm2837_state *)tsk->vm->board_data;
+  uint32_t upcoming = upcoming_expiration(s);
+  if (upcoming == 0xffffffff)
+    return 0;
+  return s->systimer.last_physical_count + upcoming;
+}
+
 void bcm2837_debug(struct task_struct *tsk) {
 }
 
@@ -463,5 +482,6 @@ const struct board_ops bcm2837_board_ops = {
   .leaving_vm = bcm2837_leaving_vm,
   .is_irq_asserted = bcm2837_is_irq_asserted,
   .is_fiq_asserted = bcm2837_is_fiq_asserted,
+  .next_timer_event = bcm2837_next_timer_event,
   .debug = bcm2837_debug,
 };
@@ -0,0 +1,52 @@
+#include "bench.h"
+#include "mm.h"
+#include "utils.h"
+#include "printf.h"
+#include "timer.h"
+
+#define BENCH_ITERATIONS 256
+
+// Measures memory operations which dominate VM creation and fault handling.
+// Compare the output of a normal build and a CACHE=off build.
+void run_memory_benchmark(void) {
+  void *src = allocate_page();
+  void *dst = allocate_page();
+  if (!src || !dst)
+    return;
+
+#ifdef CONFIG_NO_CACHE
+  printf("bench: cache=off\n");
+#else
+  printf("bench: cache=on\n");
+#endif
+
+  unsigned long begin = get_cntpct();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+    memzero(dst, PAGE_SIZE);
+  unsigned long elapsed = get_cntpct() - begin;
+  printf("bench: memzero-4k %lu ns\n", cntpct_to_ns(elapsed / BENCH_ITERATIONS));
+
+  begin = get_cntpct();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+    memcpy(dst, src, PAGE_SIZE);
+  elapsed = get_cntpct() - begin;
+  printf("bench: memcpy-4k %lu ns\n", cntpct_to_ns(elapsed / BENCH_ITERATIONS));
+
+  begin = get_cntpct();
+  for (int i = 0; i < BENCH_ITERATIONS; i++)
+    deallocate_page(allocate_page());
+  elapsed = get_cntpct() - begin;
+  printf("bench: alloc-free %lu ns\n", cntpct_to_ns(elapsed / BENCH_ITERATIONS));
+
+  void *block = allocate_pages(SECTION_SHIFT - PAGE_SHIFT);
+  if (block) {
+    begin = get_cntpct();
+    memzero(block, SECTION_SIZE);
+    elapsed = get_cntpct() - begin;
+    printf("bench: memzero-2m %lu ns\n", cntpct_to_ns(elapsed));
+    free_pages(TO_PADDR(block));
+  }
+
+  deallocate_page(src);
+  deallocate_page(dst);
+}
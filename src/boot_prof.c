@@ -0,0 +1,116 @@
+#include "boot_prof.h"
+#include "sched.h"
+#include "task.h"
+#include "timer.h"
+#include "utils.h"
+#include "printf.h"
+#include "spinlock.h"
+
+// Phases are recorded from hypervisor_main() and from the loaders of the
+// VMs, which run on any CPU. The table is printed once every VM created
+// by hypervisor_main() has entered its guest, and stays for ? + i.
+static struct boot_phase boot_phases[BOOT_PHASES];
+static int nr_boot_phases;
+static unsigned long boot_dropped; // phases beyond BOOT_PHASES
+static unsigned long boot_start;   // entry of hypervisor_main()
+static int guests_started;
+static int guests_expected = -1;   // set by boot_prof_finish()
+static spinlock_t boot_prof_lock;
+
+void boot_prof_start(void) {
+  boot_start = get_cntpct();
+}
+
+// returns the phase to pass to boot_phase_end(), -1 if the table is full
+int boot_phase_begin(const char *name, int vmid) {
+  unsigned long now = get_cntpct();
+  int i = -1;
+  spin_lock(&boot_prof_lock);
+  if (nr_boot_phases < BOOT_PHASES) {
+    i = nr_boot_phases++;
+    boot_phases[i].name = name;
+    boot_phases[i].vmid = vmid;
+    boot_phases[i].begin = now;
+    boot_phases[i].end = 0;
+    boot_phases[i].bytes = 0;
+  } else {
+    boot_dropped++;
+  }
+  spin_unlock(&boot_prof_lock);
+  return i;
+}
+
+void boot_phase_end(int i, unsigned long bytes) {
+  if (i < 0)
+    return;
+  boot_phases[i].bytes = bytes;
+  __atomic_store_n(&boot_phases[i].end, get_cntpct(), __ATOMIC_RELEASE);
+}
+
+static int boot_done(void) {
+  return guests_expected >= 0 && guests_started == guests_expected;
+}
+
+// called right before the first entry to the guest
+void boot_prof_guest_started(int vmid) {
+  int i = boot_phase_begin("first guest instruction", vmid);
+  if (i >= 0)
+    __atomic_store_n(&boot_phases[i].end, boot_phases[i].begin, __ATOMIC_RELEASE);
+
+  spin_lock(&boot_prof_lock);
+  guests_started++;
+  int done = boot_done();
+  spin_unlock(&boot_prof_lock);
+  if (done)
+    show_boot_phases();
+}
+
+// called when hypervisor_main() has created all the VMs
+void boot_prof_finish(void) {
+  spin_lock(&boot_prof_lock);
+  guests_expected = __atomic_load_n(&nr_vms, __ATOMIC_ACQUIRE) - 1;
+  int done = boot_done();
+  spin_unlock(&boot_prof_lock);
+  if (done)
+    show_boot_phases();
+}
+
+// times are from the entry of hypervisor_main()
+void show_boot_phases(void) {
+  int n = __atomic_load_n(&nr_boot_phases, __ATOMIC_ACQUIRE);
+  printf("\nboot: hypervisor entered %lu ms after the counter started\n",
+         cntpct_to_ms(boot_start));
+  printf("%3s %10s %10s %8s  %s\n", "vm", "start-us", "time-us", "KB/s",
+         "phase");
+  for (int i = 0; i < n; i++) {
+    struct boot_phase *p = &boot_phases[i];
+    unsigned long end = __atomic_load_n(&p->end, __ATOMIC_ACQUIRE);
+    unsigned long us = end ? cntpct_to_ns(end - p->begin) / 1000 : 0;
+    if (p->vmid == BOOT_NO_VM)
+      printf("%3s ", "-");
+    else
+      printf("%3d ", p->vmid);
+    printf("%10lu ", cntpct_to_ns(p->begin - boot_start) / 1000);
+    if (end == 0)
+      printf("%10s ", "running");
+    else if (end == p->begin)
+      printf("%10s ", "-");
+    else
+      printf("%10lu ", us);
+    if (p->bytes && us)
+      printf("%8lu  ", p->bytes * 1000000 / 1024 / us);
+    else
+      printf("%8s  ", "-");
+    if (p->vmid != BOOT_NO_VM && p->vmid < nr_vms)
+      printf("%s (%s)\n", p->name, vms[p->vmid]->name);
+    else
+      printf("%s\n", p->name);
+  }
+  if (boot_dropped)
+    printf("%lu phases not recorded (more than %d)\n", boot_dropped,
+           BOOT_PHASES);
+  if (guests_expected < 0)
+    printf("%d VMs started, still creating VMs\n", guests_started);
+  else if (!boot_done())
+    printf("%d of %d VMs started\n", guests_started, guests_expected);
+}
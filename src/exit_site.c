@@ -0,0 +1,108 @@
+#include "exit_site.h"
+#include "sched.h"
+#include "task.h"
+#include "mm.h"
+#include "utils.h"
+#include "printf.h"
+
+_Static_assert(sizeof(struct exit_sites) <= (PAGE_SIZE << EXIT_SITE_ORDER),
+               "exit_sites does not fit in EXIT_SITE_ORDER");
+
+volatile int exit_sites_enabled;
+
+// tables are allocated the first time recording is enabled, and cleared
+// each time it is enabled
+int enable_exit_sites(void) {
+  int n = __atomic_load_n(&nr_vms, __ATOMIC_ACQUIRE);
+  for (int i = 1; i < n; i++) {
+    struct vm_struct *vm = vms[i];
+    if (!vm->exit_sites) {
+      vm->exit_sites = (struct exit_sites *)allocate_pages(EXIT_SITE_ORDER);
+      if (!vm->exit_sites)
+        return -1;
+    } else {
+      // a vCPU may still be recording if it saw exit_sites_enabled set
+      struct exit_sites *sites = vm->exit_sites;
+      unsigned long flags = spin_lock_irqsave(&sites->lock);
+      sites->nr_exits = 0;
+      sites->dropped = 0;
+      memzero(sites->slots, sizeof(sites->slots));
+      spin_unlock_irqrestore(&sites->lock, flags);
+    }
+  }
+  __atomic_store_n(&exit_sites_enabled, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void disable_exit_sites(void) {
+  exit_sites_enabled = 0;
+}
+
+static unsigned int hash_site(unsigned long elr, int ec, unsigned long ipa) {
+  unsigned long key = (elr >> 2) ^ ((unsigned long)ec << 58) ^ (ipa >> PAGE_SHIFT);
+  return (key * 0x9e3779b97f4a7c15UL) >> (64 - EXIT_SITE_SLOTS_SHIFT);
+}
+
+// called by the handlers of synchronous exceptions of the current vCPU.
+// ipa is the faulting page of aborts, 0 otherwise.
+void exit_site_record(unsigned long elr, int ec, unsigned long ipa) {
+  if (!exit_sites_enabled)
+    return;
+  struct exit_sites *sites = current->vm->exit_sites;
+  if (!sites)
+    return;
+  unsigned int h = hash_site(elr, ec, ipa);
+  spin_lock(&sites->lock);
+  sites->nr_exits++;
+  for (int i = 0; i < EXIT_SITE_MAX_PROBES; i++) {
+    struct exit_site *s = &sites->slots[(h + i) & (EXIT_SITE_SLOTS - 1)];
+    if (s->count == 0) {
+      s->elr = elr;
+      s->ec = ec;
+      s->ipa = ipa;
+    } else if (s->elr != elr || s->ec != ec || s->ipa != ipa) {
+      continue;
+    }
+    s->count++;
+    spin_unlock(&sites->lock);
+    return;
+  }
+  sites->dropped++;
+  spin_unlock(&sites->lock);
+}
+
+static void show_vm_exit_sites(struct vm_struct *vm) {
+  struct exit_sites *sites = vm->exit_sites;
+  if (!sites)
+    return;
+
+  // copied under the lock, since printing takes long
+  struct exit_site top[EXIT_SITE_TOP];
+  int n = 0;
+  unsigned long flags = spin_lock_irqsave(&sites->lock);
+  unsigned long nr_exits = sites->nr_exits;
+  unsigned long dropped = sites->dropped;
+  for (int i = 0; i < EXIT_SITE_SLOTS; i++) {
+    struct exit_site *s = &sites->slots[i];
+    if (s->count == 0 || (n == EXIT_SITE_TOP && s->count <= top[n - 1].count))
+      continue;
+    // insertion into the sorted top entries
+    int j = n < EXIT_SITE_TOP ? n++ : n - 1;
+    for (; j > 0 && top[j - 1].count < s->count; j--)
+      top[j] = top[j - 1];
+    top[j] = *s;
+  }
+  spin_unlock_irqrestore(&sites->lock, flags);
+
+  printf("vm %d: %ld exits, %ld not counted\n", vm->id, nr_exits, dropped);
+  for (int i = 0; i < n; i++) {
+    struct exit_site *s = &top[i];
+    printf("%3d %2x %8d %16lx %16lx\n", vm->id, s->ec, s->count, s->elr, s->ipa);
+  }
+}
+
+void show_exit_sites(void) {
+  printf("\n%3s %2s %8s %16s %16s\n", "vm", "ec", "count", "elr", "ipa");
+  for (int i = 1; i < nr_vms; i++)
+    show_vm_exit_sites(vms[i]);
+}
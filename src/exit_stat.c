@@ -0,0 +1,195 @@
+#include "exit_stat.h"
+#include "sched.h"
+#include "task.h"
+#include "timer.h"
+#include "printf.h"
+#include "smp.h"
+#include "utils.h"
+#include "trace.h"
+
+_Static_assert(sizeof(struct exit_stats) <= (PAGE_SIZE << EXIT_STATS_ORDER),
+               "exit_stats does not fit in EXIT_STATS_ORDER");
+
+// the exit being handled on each CPU
+struct exit_record {
+  struct task_struct *task; // NULL if not counted
+  int reason;
+  unsigned long entry_time; // in kernel_entry
+  unsigned long leave_done; // end of vm_leaving_work()
+  // for the trace
+  unsigned long esr;
+  unsigned long elr;
+  unsigned long addr;
+  unsigned long value;
+};
+
+static struct exit_record exit_records[NR_CPUS];
+
+struct exit_stats *allocate_exit_stats(void) {
+  return (struct exit_stats *)allocate_pages(EXIT_STATS_ORDER);
+}
+
+// called at the end of vm_leaving_work()
+void exit_stat_leaving(unsigned long entry_time, unsigned long now) {
+  struct exit_record *r = &exit_records[smp_processor_id()];
+  r->task = current;
+  r->reason = EXIT_REASON_IRQ;
+  r->entry_time = entry_time;
+  r->leave_done = now;
+  r->esr = 0;
+  r->elr = task_pt_regs(current)->pc;
+  r->addr = 0;
+  r->value = 0;
+}
+
+#define ESR_EL2_EC_IABT_LOW 0x20
+#define ESR_EL2_EC_DABT_LOW 0x24
+
+// called by handle_sync_exception()
+void exit_stat_set_sync(unsigned long esr, unsigned long far) {
+  struct exit_record *r = &exit_records[smp_processor_id()];
+  int ec = (esr >> 26) & 0x3f;
+  r->reason = ec;
+  r->esr = esr;
+  if (trace_enabled && (ec == ESR_EL2_EC_IABT_LOW || ec == ESR_EL2_EC_DABT_LOW))
+    r->addr = ((get_hpfar() & ~0xfUL) << 8) | (far & 0xfff);
+}
+
+// called by handle_mem_abort() for emulated MMIO
+void exit_stat_set_mmio(unsigned long value) {
+  if (trace_enabled)
+    exit_records[smp_processor_id()].value = value;
+}
+
+static void trace_exit_record(struct exit_record *r, unsigned long now,
+                              int result) {
+  struct trace_entry e;
+  e.timestamp = r->entry_time;
+  e.elr = r->elr;
+  e.addr = r->addr;
+  e.esr = r->esr;
+  e.duration = MIN(now - r->entry_time, 0xffffffffUL);
+  e.vmid = r->task->vm->id;
+  e.vcpu = r->task->vcpu_id;
+  e.reason = r->reason;
+  e.result = result;
+  e.reserved = 0;
+  e.value = r->value;
+  trace_exit(&e);
+}
+
+// called by switch_to() before prev is switched out
+void exit_stat_switch(struct task_struct *prev) {
+  struct exit_record *r = &exit_records[smp_processor_id()];
+  if (r->task != prev)
+    return;
+  if (trace_enabled)
+    trace_exit_record(r, get_cntpct(), TRACE_RESULT_SWITCHED);
+  r->task = 0;
+}
+
+static int log2_bucket(unsigned long v) {
+  if (v == 0)
+    return 0;
+  return MIN(63 - __builtin_clzl(v), NR_EXIT_BUCKETS - 1);
+}
+
+// called at the end of vm_entering_work(), begin is its start
+void exit_stat_entering(unsigned long begin, unsigned long now) {
+  struct exit_record *r = &exit_records[smp_processor_id()];
+  struct task_struct *tsk = current;
+
+  // exits which caused a task switch are not counted
+  if (r->task != tsk) {
+    r->task = 0;
+    return;
+  }
+  if (trace_enabled)
+    trace_exit_record(r, now, TRACE_RESULT_RESUMED);
+  r->task = 0;
+
+  unsigned long latency = now - r->entry_time;
+  tsk->stat.exit_cycles += latency;
+  tsk->stat.exit_count++;
+
+  if (!tsk->exit_stats)
+    return;
+  struct exit_hist *h = &tsk->exit_stats->reasons[r->reason];
+  if (h->count == 0 || latency < h->min)
+    h->min = latency;
+  if (latency > h->max)
+    h->max = latency;
+  h->count++;
+  h->total += latency;
+  h->leave_total += r->leave_done - r->entry_time;
+  h->handle_total += begin - r->leave_done;
+  h->enter_total += now - begin;
+  h->buckets[log2_bucket(latency)]++;
+}
+
+static const char *exit_reason_name(int reason) {
+  switch (reason) {
+  case 0x01: return "WFx";
+  case 0x07: return "FP";
+  case 0x16: return "HVC64";
+  case 0x17: return "SMC64";
+  case 0x18: return "SYSREG";
+  case 0x20: return "IABT";
+  case 0x24: return "DABT";
+  case EXIT_REASON_IRQ: return "IRQ";
+  }
+  return "";
+}
+
+// upper bound of the bucket containing the 99th percentile
+static unsigned long hist_p99(struct exit_hist *h) {
+  unsigned long threshold = h->count - h->count / 100;
+  unsigned long sum = 0;
+  for (int b = 0; b < NR_EXIT_BUCKETS; b++) {
+    sum += h->buckets[b];
+    if (sum >= threshold)
+      return MIN((2UL << b) - 1, h->max);
+  }
+  return h->max;
+}
+
+static void show_vm_exit_stats(struct vm_struct *vm) {
+  struct exit_hist sum;
+  for (int reason = 0; reason < NR_EXIT_REASONS; reason++) {
+    memzero(&sum, sizeof(sum));
+    for (int i = 0; i < vm->nr_vcpus; i++) {
+      struct exit_stats *stats = vm->vcpus[i]->exit_stats;
+      if (!stats)
+        continue;
+      struct exit_hist *h = &stats->reasons[reason];
+      if (h->count == 0)
+        continue;
+      if (sum.count == 0 || h->min < sum.min)
+        sum.min = h->min;
+      sum.max = MAX(sum.max, h->max);
+      sum.count += h->count;
+      sum.total += h->total;
+      sum.leave_total += h->leave_total;
+      sum.handle_total += h->handle_total;
+      sum.enter_total += h->enter_total;
+      for (int b = 0; b < NR_EXIT_BUCKETS; b++)
+        sum.buckets[b] += h->buckets[b];
+    }
+    if (sum.count == 0)
+      continue;
+    unsigned long n = sum.count;
+    printf("%3d %2x %6s %8lu %7lu %7lu %7lu %7lu %7lu %7lu %7lu\n", vm->id, reason,
+        exit_reason_name(reason), n, cntpct_to_ns(sum.min),
+        cntpct_to_ns(sum.total / n), cntpct_to_ns(hist_p99(&sum)),
+        cntpct_to_ns(sum.max), cntpct_to_ns(sum.leave_total / n),
+        cntpct_to_ns(sum.handle_total / n), cntpct_to_ns(sum.enter_total / n));
+  }
+}
+
+// latencies in ns, measured from kernel_entry to the end of vm_entering_work()
+void show_exit_stats(void) {
+  printf("%3s %2s %6s %8s %7s %7s %7s %7s %7s %7s %7s\n", "vm", "ec", "reason",
+      "count", "min", "mean", "p99", "max", "leave", "handle", "enter");
+  for (int i = 1; i < nr_vms; i++)
+    show_vm_exit_stats(vms[i]);
+}
@@ -1,9 +1,12 @@
 #include "fifo.h"
 #include "mm.h"
+#include "spinlock.h"
 
 #define FIFO_SIZE  256  // warning: DO NOT exceed page size
 
+// console FIFOs are filled and drained by different CPUs
 struct fifo {
+  spinlock_t lock;
   unsigned int head;
   unsigned int tail;
   unsigned int used;
@@ -22,6 +25,8 @@ int is_full_fifo(struct fifo *fifo) {
 
 struct fifo *create_fifo() {
   struct fifo *fifo = (struct fifo *)allocate_page();
+  if (!fifo)
+    return 0;
   fifo->head = 0;
   fifo->tail = 0;
   fifo->used = 0;
@@ -30,25 +35,34 @@ struct fifo *create_fifo() {
 }
 
 void clear_fifo(struct fifo *fifo) {
+  unsigned long flags = spin_lock_irqsave(&fifo->lock);
   fifo->head = 0;
   fifo->tail = 0;
   fifo->used = 0;
+  spin_unlock_irqrestore(&fifo->lock, flags);
 }
 
 int enqueue_fifo(struct fifo *fifo, unsigned long val) {
-  if (is_full_fifo(fifo))
+  unsigned long flags = spin_lock_irqsave(&fifo->lock);
+  if (is_full_fifo(fifo)) {
+    spin_unlock_irqrestore(&fifo->lock, flags);
     return -1;
+  }
 
   fifo->buf[fifo->head] = val;
   fifo->head = NEXT_INDEX(fifo->head);
   fifo->used++;
 
+  spin_unlock_irqrestore(&fifo->lock, flags);
   return 0;
 }
 
 int dequeue_fifo(struct fifo *fifo, unsigned long *val) {
-  if (is_empty_fifo(fifo))
+  unsigned long flags = spin_lock_irqsave(&fifo->lock);
+  if (is_empty_fifo(fifo)) {
+    spin_unlock_irqrestore(&fifo->lock, flags);
     return -1;
+  }
 
   if (val)
     *val = fifo->buf[fifo->tail];
@@ -56,6 +70,7 @@ int dequeue_fifo(struct fifo *fifo, unsigned long *val) {
   fifo->tail = NEXT_INDEX(fifo->tail);
   fifo->used--;
 
+  spin_unlock_irqrestore(&fifo->lock, flags);
   return 0;
 }
 
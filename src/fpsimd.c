@@ -0,0 +1,46 @@
+#include "fpsimd.h"
+#include "sched.h"
+#include "smp.h"
+
+// The hypervisor itself is built with -mgeneral-regs-only and never
+// touches FP/SIMD registers, so they are restored only when a VM actually
+// uses them. They are saved when the VM is switched out, so that it can
+// be run on another CPU.
+
+// VM whose FP/SIMD registers were last loaded on each CPU. They are still
+// there if the VM has not loaded them on another CPU since.
+static struct task_struct *fpsimd_last[NR_CPUS];
+// FP/SIMD access is not trapped for the running VM
+static int fpsimd_enabled[NR_CPUS];
+
+static int fpsimd_loaded(struct task_struct *tsk, int cpu) {
+  return fpsimd_last[cpu] == tsk && tsk->fpsimd_cpu == cpu;
+}
+
+void fpsimd_switch_to(struct task_struct *prev, struct task_struct *next) {
+  int cpu = smp_processor_id();
+  if (fpsimd_enabled[cpu]) {
+    fpsimd_save(prev->fpsimd);
+    fpsimd_enabled[cpu] = 0;
+  }
+  if (!next->vm)
+    return;
+  if (fpsimd_loaded(next, cpu)) {
+    disable_fpsimd_trap();
+    fpsimd_enabled[cpu] = 1;
+  } else {
+    enable_fpsimd_trap();
+  }
+}
+
+// the trapped instruction is executed again after returning to the VM
+void handle_trap_fpsimd(void) {
+  int cpu = smp_processor_id();
+  disable_fpsimd_trap();
+  fpsimd_enabled[cpu] = 1;
+  if (fpsimd_loaded(current, cpu))
+    return;
+  fpsimd_restore(current->fpsimd);
+  fpsimd_last[cpu] = current;
+  current->fpsimd_cpu = cpu;
+}
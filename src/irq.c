@@ -1,4 +1,6 @@
 #include "peripherals/irq.h"
+#include "peripherals/local.h"
+#include "irq.h"
 #include "arm/sysregs.h"
 #include "entry.h"
 #include "timer.h"
@@ -6,6 +8,8 @@
 #include "sched.h"
 #include "debug.h"
 #include "mini_uart.h"
+#include "smp.h"
+#include "pmu.h"
 
 const char *entry_error_messages[] = {
   "SYNC_INVALID_EL2",
@@ -24,10 +28,17 @@ const char *entry_error_messages[] = {
   "ERROR_INVALID_EL01_32",
 };
 
+// peripheral interrupts are routed to CPU0
 void enable_interrupt_controller() {
-  put32(ENABLE_IRQS_1, SYSTEM_TIMER_IRQ_1_BIT);
   put32(ENABLE_IRQS_1, SYSTEM_TIMER_IRQ_3_BIT);
   put32(ENABLE_IRQS_1, AUX_IRQ_BIT);
+  enable_local_interrupts(0);
+}
+
+// scheduler tick and IPI of each CPU
+void enable_local_interrupts(int cpu) {
+  put32(CORE_TIMER_IRQCNTL(cpu), CORE_TIMER_CNTHP);
+  put32(CORE_MBOX_IRQCNTL(cpu), CORE_MBOX0);
 }
 
 void show_invalid_entry_message(int type, unsigned long esr,
@@ -36,12 +47,8 @@ void show_invalid_entry_message(int type, unsigned long esr,
          esr, elr, far);
 }
 
-void handle_irq(void) {
+static void handle_gpu_irq(void) {
   unsigned int irq = get32(IRQ_PENDING_1);
-  if (irq & SYSTEM_TIMER_IRQ_1_BIT) {
-    irq &= ~SYSTEM_TIMER_IRQ_1_BIT;
-    handle_timer1_irq();
-  }
   if (irq & SYSTEM_TIMER_IRQ_3_BIT) {
     irq &= ~SYSTEM_TIMER_IRQ_3_BIT;
     handle_timer3_irq();
@@ -54,3 +61,16 @@ void handle_irq(void) {
   if (irq)
     WARN("unknown pending irq: %x", irq);
 }
+
+void handle_irq(void) {
+  unsigned int source = get32(CORE_IRQ_SOURCE(smp_processor_id()));
+  if (source & CORE_IRQ_MAILBOX0)
+    handle_ipi();
+  if (source & CORE_IRQ_CNTHP)
+    handle_sched_timer_irq();
+  if (source & CORE_IRQ_GPU)
+    handle_gpu_irq();
+  if (source & CORE_IRQ_PMU)
+    handle_pmu_irq();
+  check_preempt_wakeup();
+}
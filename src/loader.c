@@ -5,25 +5,32 @@
 #include "sched.h"
 #include "utils.h"
 #include "debug.h"
+#include "boot_prof.h"
 
 // va should be page-aligned.
 int load_file_to_memory(struct task_struct *tsk, const char *name, unsigned long va) {
+  int vmid = tsk->vm->id;
   struct fat32_fs hfat;
+  int phase = boot_phase_begin("fat32 mount", vmid);
   if (fat32_get_handle(&hfat) < 0) {
     WARN("failed to find fat32 filesystem.");
     return -1;
   }
+  boot_phase_end(phase, 0);
 
   struct fat32_file file;
+  phase = boot_phase_begin("lookup", vmid);
   if (fat32_lookup(&hfat, name, &file) < 0) {
     WARN("requested file \"%s\" is not found.", name);
     return -1;
   }
+  boot_phase_end(phase, 0);
 
   int remain = fat32_file_size(&file);
   int offset = 0;
   unsigned long current_va = va & PAGE_MASK;
 
+  phase = boot_phase_begin("read", vmid);
   while (remain > 0) {
     uint8_t *buf = allocate_task_page(tsk, current_va);
     int readsz = MIN(PAGE_SIZE, remain);
@@ -33,13 +40,15 @@ int load_file_to_memory(struct task_struct *tsk, const char *name, unsigned long
       WARN("error during file read");
       return -1;
     }
+    flush_dcache_range(buf, PAGE_SIZE);
 
     remain -= readsz;
     offset += readsz;
     current_va += PAGE_SIZE;
   }
+  boot_phase_end(phase, offset);
 
-  tsk->name = name;
+  tsk->vm->name = name;
 
   return 0;
 }
@@ -12,29 +12,93 @@
 #include "sd.h"
 #include "debug.h"
 #include "loader.h"
+#include "smp.h"
+#include "pmu.h"
+#include "boot_prof.h"
+#include "trace.h"
+
+static void idle_loop(void) {
+  while (1) {
+    disable_irq();
+    schedule();
+    enable_irq();
+    run_trace_dump();
+    if (refill_zero_pool() == 0) {
+      // sleep at EL2 until an interrupt makes a VM runnable. IRQs are
+      // masked so that a wakeup between the check and WFI is not lost.
+      disable_irq();
+      if (nr_running_tasks() == 0)
+        wait_for_interrupt();
+      enable_irq();
+    }
+  }
+}
+
+// entered from secondary_startup in boot.S
+void secondary_main(int cpu) {
+  init_idle_task(cpu);
+  irq_vector_init();
+  enable_local_interrupts(cpu);
+  set_cpu_online(cpu);
+  INFO("cpu%d started", cpu);
+  idle_loop();
+}
 
 void hypervisor_main() {
+  boot_prof_start();
+  int phase = boot_phase_begin("uart_init", BOOT_NO_VM);
   uart_init();
   init_printf(NULL, putc);
+  boot_phase_end(phase, 0);
   printf("=== raspvisor ===\n");
 
-  init_task_console(current);
-  init_initial_task();
+  phase = boot_phase_begin("hypervisor init", BOOT_NO_VM);
+  mm_init();
+  sched_init();
   irq_vector_init();
   timer_init();
+  pmu_init();
   disable_irq();
   enable_interrupt_controller();
+  boot_phase_end(phase, 0);
 
+  phase = boot_phase_begin("smp boot", BOOT_NO_VM);
+  smp_boot_secondaries();
+  boot_phase_end(phase, 0);
+
+  phase = boot_phase_begin("sd_init", BOOT_NO_VM);
   if (sd_init() < 0)
     PANIC("sd_init() failed.");
+  boot_phase_end(phase, 0);
+
+  struct vm_params params = {
+    .nr_vcpus = 1,
+    .weight = SCHED_DEFAULT_WEIGHT,
+    .cap = 0,
+    .timeslice = SCHED_DEFAULT_TIMESLICE,
+    .prefault_size = 0x100000, // the image and the stack below sp
+  };
 
+#ifdef CONFIG_BENCH_GUEST
+  // alone, so that the results are not disturbed by other VMs
+  struct raw_binary_loader_args bench_args = {
+    .load_addr = 0x0,
+    .entry_point = 0x0,
+    .sp = 0x100000,
+    .filename = "bench.bin",
+  };
+  if (create_vm(raw_binary_loader, &bench_args, &params) < 0) {
+    printf("error while starting task");
+    return;
+  }
+#else
   struct raw_binary_loader_args bl_args1 = {
     .load_addr = 0x0,
     .entry_point = 0x0,
     .sp = 0x100000,
     .filename = "mini-os.bin",
   };
-  if (create_task(raw_binary_loader, &bl_args1) < 0) {
+  if (create_vm(raw_binary_loader, &bl_args1, &params) < 0) {
     printf("error while starting task");
     return;
   }
@@ -45,7 +109,7 @@ void hypervisor_main() {
     .sp = 0x100000,
     .filename = "echo.bin",
   };
-  if (create_task(raw_binary_loader, &bl_args2) < 0) {
+  if (create_vm(raw_binary_loader, &bl_args2, &params) < 0) {
     printf("error while starting task");
     return;
   }
@@ -56,7 +120,7 @@ void hypervisor_main() {
     .sp = 0x100000,
     .filename = "mini-os.bin",
   };
-  if (create_task(raw_binary_loader, &bl_args3) < 0) {
+  if (create_vm(raw_binary_loader, &bl_args3, &params) < 0) {
     printf("error while starting task #2");
     return;
   }
@@ -67,7 +131,7 @@ void hypervisor_main() {
     .sp = 0x100000,
     .filename = "echo.bin",
   };
-  if (create_task(raw_binary_loader, &bl_args4) < 0) {
+  if (create_vm(raw_binary_loader, &bl_args4, &params) < 0) {
     printf("error while starting task");
     return;
   }
@@ -78,14 +142,12 @@ void hypervisor_main() {
     .sp = 0x100000,
     .filename = "mini-os.bin",
   };
-  if (create_task(raw_binary_loader, &bl_args5) < 0) {
+  if (create_vm(raw_binary_loader, &bl_args5, &params) < 0) {
     printf("error while starting task");
     return;
   }
+#endif
 
-  while (1) {
-    disable_irq();
-    schedule();
-    enable_irq();
-  }
+  boot_prof_finish();
+  idle_loop();
 }
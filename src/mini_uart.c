@@ -5,6 +5,12 @@
 #include "fifo.h"
 #include "printf.h"
 #include "task.h"
+#include "bench.h"
+#include "exit_stat.h"
+#include "trace.h"
+#include "profile.h"
+#include "exit_site.h"
+#include "boot_prof.h"
 
 static void _uart_send(char c) {
   while (1) {
@@ -23,6 +29,11 @@ void uart_send(char c) {
   }
 }
 
+// without the newline conversion (for binary data)
+void uart_send_raw(char c) {
+  _uart_send(c);
+}
+
 char uart_recv(void) {
   while (1) {
     if (get32(AUX_MU_LSR_REG) & 0x01)
@@ -37,29 +48,136 @@ char uart_recv(void) {
 }
 
 #define ESCAPE_CHAR  '?'
-static int uart_forwarded_task = 1;
+static int uart_forwarded_vm = 1;
+
+int is_uart_forwarded_vm(struct vm_struct *vm) {
+  return vm->id == uart_forwarded_vm;
+}
 
-int is_uart_forwarded_task(struct task_struct *tsk) {
-  return tsk->pid == uart_forwarded_task;
+// command lines read after ESCAPE_CHAR + 's' or 'p'
+#define CMDLINE_SIZE 32
+static char cmdline[CMDLINE_SIZE];
+static int cmdline_len = -1; // -1 if not reading a command line
+static void (*cmdline_handler)(const char *);
+
+static int parse_uint(const char **s) {
+  int n = 0;
+  while (**s == ' ')
+    (*s)++;
+  if (!isdigit(**s))
+    return -1;
+  while (isdigit(**s)) {
+    n = n * 10 + (**s - '0');
+    (*s)++;
+  }
+  return n;
+}
+
+// <vm> <weight> <cap %> <timeslice ms>
+static void run_sched_command(const char *s) {
+  int id = parse_uint(&s);
+  int weight = parse_uint(&s);
+  int cap = parse_uint(&s);
+  int timeslice = parse_uint(&s);
+  if (timeslice < 0 || id <= 0 || id >= nr_vms) {
+    printf("usage: <vm> <weight> <cap %%> <timeslice ms>\n");
+    return;
+  }
+  if (set_vm_sched_params(vms[id], weight, cap, timeslice * 1000UL) < 0)
+    printf("invalid parameter\n");
+}
+
+// <sampling period ms>, 0: off
+static void run_profile_command(const char *s) {
+  int period = parse_uint(&s);
+  if (period < 0) {
+    printf("usage: <sampling period ms>\n");
+    return;
+  }
+  if (set_profile_period(period) < 0)
+    printf("failed to allocate the histograms\n");
+  else
+    printf("profile %s\n", period ? "on" : "off");
+}
+
+// returns 1 while a command line is read
+static int read_cmdline(char c) {
+  if (cmdline_len < 0)
+    return 0;
+  if (c == '\r' || c == '\n') {
+    printf("\n");
+    cmdline[cmdline_len] = '\0';
+    cmdline_len = -1;
+    cmdline_handler(cmdline);
+  } else if (c == 0x7f || c == '\b') {
+    if (cmdline_len > 0) {
+      cmdline_len--;
+      printf("\b \b");
+    }
+  } else if (cmdline_len < CMDLINE_SIZE - 1) {
+    cmdline[cmdline_len++] = c;
+    printf("%c", c);
+  }
+  return 1;
 }
 
 void handle_uart_irq(void) {
   static int is_escaped = 0;
 
   char received = get32(AUX_MU_IO_REG) & 0xff;
-  struct task_struct *tsk;
+  struct vm_struct *vm;
   //printf("received: %c\n", received);
 
-  if (is_escaped) {
+  if (read_cmdline(received)) {
+    // consumed
+  } else if (is_escaped) {
     is_escaped = 0;
     if (isdigit(received)) {
-      uart_forwarded_task = received - '0';
-      printf("\nswitched to %d\n", uart_forwarded_task);
-      tsk = task[uart_forwarded_task];
-      if (tsk->state == TASK_RUNNING)
-        flush_task_console(tsk);
+      uart_forwarded_vm = received - '0';
+      printf("\nswitched to %d\n", uart_forwarded_vm);
+      vm = vms[uart_forwarded_vm];
+      if (vm && vm->vcpus[0]->state != TASK_ZOMBIE)
+        flush_vm_console(vm);
     } else if (received == 'l') {
       show_task_list();
+    } else if (received == 'e') {
+      show_exit_stats();
+    } else if (received == 't') {
+      if (trace_enabled) {
+        disable_trace();
+        printf("\ntrace off\n");
+      } else if (enable_trace() < 0) {
+        printf("\nfailed to start the trace (out of memory, or dumping)\n");
+      } else {
+        printf("\ntrace on\n");
+      }
+    } else if (received == 'a') {
+      if (exit_sites_enabled) {
+        disable_exit_sites();
+        printf("\nexit sites off\n");
+      } else if (enable_exit_sites() < 0) {
+        printf("\nfailed to allocate the exit site tables\n");
+      } else {
+        printf("\nexit sites on\n");
+      }
+    } else if (received == 'x') {
+      show_exit_sites();
+    } else if (received == 'd') {
+      dump_trace();
+    } else if (received == 'b') {
+      run_memory_benchmark();
+    } else if (received == 's') {
+      printf("\nsched> ");
+      cmdline_handler = run_sched_command;
+      cmdline_len = 0;
+    } else if (received == 'p') {
+      printf("\nprofile> ");
+      cmdline_handler = run_profile_command;
+      cmdline_len = 0;
+    } else if (received == 'r') {
+      dump_profile();
+    } else if (received == 'i') {
+      show_boot_phases();
     } else if (received == ESCAPE_CHAR) {
       goto enqueue_char;
     }
@@ -67,9 +185,11 @@ void handle_uart_irq(void) {
     is_escaped = 1;
   } else {
 enqueue_char:
-    tsk = task[uart_forwarded_task];
-    if (tsk->state == TASK_RUNNING) {
-      enqueue_fifo(tsk->console.in_fifo, received);
+    vm = vms[uart_forwarded_vm];
+    // the UART interrupt of the guest is delivered to vCPU 0
+    if (vm && vm->vcpus[0]->state != TASK_ZOMBIE) {
+      enqueue_fifo(vm->console.in_fifo, received);
+      wake_up_task(vm->vcpus[0]);
     }
   }
 
@@ -1,55 +1,26 @@
 #include "utils.h"
 #include "debug.h"
+#include "irq.h"
 #include "mm.h"
 #include "board.h"
 #include "task.h"
 #include "arm/mmu.h"
-
-static unsigned short mem_map[PAGING_PAGES] = { 0 };
-
-paddr_t get_free_page(void);
-void free_page(paddr_t);
-
-void *allocate_page() {
-  paddr_t page = get_free_page();
-  if (page == 0) {
-    return 0;
-  }
-  return (void *)TO_VADDR(page);
-}
-
-void deallocate_page(void *page) {
-  free_page(TO_PADDR(page));
-}
+#include "spinlock.h"
+#include "exit_site.h"
+#include "exit_stat.h"
 
 void *allocate_task_page(struct task_struct *task, vaddr_t va) {
   paddr_t page = get_free_page();
   if (page == 0) {
     return 0;
   }
-  map_stage2_page(task, va, page, MMU_STAGE2_PAGE_FLAGS);
+  map_stage2_page(task->vm, va, page, MMU_STAGE2_PAGE_FLAGS);
+  task->vm->mm.page_mappings_count++;
   return (void *)TO_VADDR(page);
 }
 
 void set_task_page_notaccessable(struct task_struct *task, vaddr_t va) {
-  map_stage2_page(task, va, 0, MMU_STAGE2_MMIO_PAGE_FLAGS);
-}
-
-paddr_t get_free_page() {
-  for (int i = 0; i < PAGING_PAGES; i++) {
-    if (mem_map[i] == 0) {
-      mem_map[i] = 1;
-      paddr_t page = LOW_MEMORY + i * PAGE_SIZE;
-      memzero((void *)TO_VADDR(page), PAGE_SIZE);
-      return page;
-    }
-  }
-  PANIC("no free pages!");
-  return 0;
-}
-
-void free_page(paddr_t p) {
-  mem_map[(p - LOW_MEMORY) / PAGE_SIZE] = 0;
+  map_stage2_page(task->vm, va, 0, MMU_STAGE2_MMIO_PAGE_FLAGS);
 }
 
 void map_stage2_table_entry(vaddr_t pte, vaddr_t va,
@@ -76,27 +47,269 @@ paddr_t map_stage2_table(vaddr_t table, uint64_t shift,
   return ((uint64_t *)table)[index] & PAGE_MASK;
 }
 
-void map_stage2_page(struct task_struct *task, vaddr_t va,
-                     paddr_t page, uint64_t flags) {
+static paddr_t get_stage2_lv2_table(struct vm_struct *vm, vaddr_t va) {
   paddr_t lv1_table;
-  if (!task->mm.first_table) {
-    task->mm.first_table = get_free_page();
-    task->mm.kernel_pages_count++;
+  if (!vm->mm.first_table) {
+    vm->mm.first_table = get_free_page();
+    vm->mm.kernel_pages_count++;
   }
-  lv1_table = task->mm.first_table;
+  lv1_table = vm->mm.first_table;
   int new_table;
   paddr_t lv2_table = map_stage2_table(TO_VADDR(lv1_table),
                                        LV1_SHIFT, va, &new_table);
   if (new_table) {
-    task->mm.kernel_pages_count++;
+    vm->mm.kernel_pages_count++;
   }
+  return lv2_table;
+}
+
+static paddr_t get_stage2_lv3_table(struct vm_struct *vm, vaddr_t va) {
+  paddr_t lv2_table = get_stage2_lv2_table(vm, va);
+  int new_table;
   paddr_t lv3_table = map_stage2_table(TO_VADDR(lv2_table),
                                        LV2_SHIFT, va, &new_table);
   if (new_table) {
-    task->mm.kernel_pages_count++;
+    vm->mm.kernel_pages_count++;
   }
+  return lv3_table;
+}
+
+void map_stage2_page(struct vm_struct *vm, vaddr_t va,
+                     paddr_t page, uint64_t flags) {
+  paddr_t lv3_table = get_stage2_lv3_table(vm, va);
   map_stage2_table_entry(TO_VADDR(lv3_table), va, page, flags);
-  task->mm.user_pages_count++;
+  vm->mm.user_pages_count++;
+}
+
+// Frees the stage-2 tables of a VM and the guest memory mapped by them.
+// The vCPUs of the VM must not run anymore.
+void free_stage2_tables(struct vm_struct *vm) {
+  struct mm_struct *mm = &vm->mm;
+  if (!mm->first_table)
+    return;
+  uint64_t *lv1_table = (uint64_t *)TO_VADDR(mm->first_table);
+  for (int i = 0; i < PTRS_PER_TABLE; i++) {
+    if (!lv1_table[i])
+      continue;
+    uint64_t *lv2_table = (uint64_t *)TO_VADDR((lv1_table[i] & PAGE_MASK));
+    for (int j = 0; j < PTRS_PER_TABLE; j++) {
+      uint64_t entry = lv2_table[j];
+      if (!entry)
+        continue;
+      if ((entry & 0x3) != MM_TYPE_PAGE_TABLE) {
+        free_pages(entry & PAGE_MASK);
+        continue;
+      }
+      uint64_t *lv3_table = (uint64_t *)TO_VADDR((entry & PAGE_MASK));
+      for (int k = 0; k < PTRS_PER_TABLE; k++) {
+        // mmio pages have no memory behind them
+        if ((lv3_table[k] & ~PAGE_MASK) == MMU_STAGE2_PAGE_FLAGS)
+          free_page(lv3_table[k] & PAGE_MASK);
+      }
+      free_page(TO_PADDR(lv3_table));
+    }
+    free_page(TO_PADDR(lv2_table));
+  }
+  free_page(mm->first_table);
+  mm->first_table = 0;
+  mm->user_pages_count = 0;
+  mm->kernel_pages_count = 0;
+  mm->block_mappings_count = 0;
+  mm->page_mappings_count = 0;
+}
+
+// returns the level 2 (block) or level 3 entry for va, 0 if not mapped
+static uint64_t get_stage2_entry(struct vm_struct *vm, vaddr_t va) {
+  if (!vm->mm.first_table)
+    return 0;
+  uint64_t *lv1_table = (uint64_t *)TO_VADDR(vm->mm.first_table);
+  uint64_t entry = lv1_table[(va >> (LV1_SHIFT)) & (PTRS_PER_TABLE - 1)];
+  if (!entry)
+    return 0;
+  uint64_t *lv2_table = (uint64_t *)TO_VADDR((entry & PAGE_MASK));
+  entry = lv2_table[(va >> (LV2_SHIFT)) & (PTRS_PER_TABLE - 1)];
+  if ((entry & 0x3) != MM_TYPE_PAGE_TABLE)
+    return entry;
+  uint64_t *lv3_table = (uint64_t *)TO_VADDR((entry & PAGE_MASK));
+  return lv3_table[(va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1)];
+}
+
+void set_stage2_block_policy(struct vm_struct *vm, int policy,
+                             int threshold) {
+  vm->mm.block_policy = policy;
+  vm->mm.block_threshold = threshold;
+}
+
+void set_stage2_fault_around(struct vm_struct *vm, int pages) {
+  // must be a power of 2 so that the window stays in one level 3 table
+  int n = 1;
+  while (n * 2 <= pages && n * 2 <= PTRS_PER_TABLE)
+    n *= 2;
+  vm->mm.fault_around_pages = n;
+}
+
+void set_stage2_prefault(struct vm_struct *vm, unsigned long size) {
+  vm->mm.prefault_size = size;
+}
+
+#define LV2_INDEX(va) (((va) >> SECTION_SHIFT) & (PTRS_PER_TABLE - 1))
+#define SECTION_ORDER (SECTION_SHIFT - PAGE_SHIFT)
+
+// Maps the 2MB region containing ipa with a level 2 block descriptor.
+// Pages already mapped in the region are copied into the new block and
+// their level 3 table is released. Returns the number of pages newly
+// mapped, or -1 if fewer than threshold pages would be mapped (the caller
+// falls back to a page mapping).
+static int map_stage2_block(struct vm_struct *vm, vaddr_t ipa,
+                            int threshold) {
+  struct mm_struct *mm = &vm->mm;
+  vaddr_t base = ipa & ~((vaddr_t)SECTION_SIZE - 1);
+
+  if (threshold < 0 || base + SECTION_SIZE > DEVICE_BASE)
+    return -1;
+
+  uint64_t *lv2_table = (uint64_t *)TO_VADDR(get_stage2_lv2_table(vm, base));
+  uint64_t lv2_entry = lv2_table[LV2_INDEX(base)];
+  uint64_t *lv3_table = 0;
+  int mapped = 0;
+
+  if (lv2_entry) {
+    // already a block (e.g. prefault_stage2() on a mapped region)
+    if ((lv2_entry & 0x3) != MM_TYPE_PAGE_TABLE)
+      return -1;
+    lv3_table = (uint64_t *)TO_VADDR((lv2_entry & PAGE_MASK));
+    for (int i = 0; i < PTRS_PER_TABLE; i++) {
+      if (!lv3_table[i])
+        continue;
+      // mmio pages can not be merged
+      if ((lv3_table[i] & ~PAGE_MASK) != MMU_STAGE2_PAGE_FLAGS)
+        return -1;
+      mapped++;
+    }
+  }
+  // the faulting page is counted
+  if (mapped + 1 < threshold)
+    return -1;
+
+  paddr_t block = get_free_pages(SECTION_ORDER);
+  if (block == 0)
+    return -1;
+
+  // break-before-make: other vCPUs of the VM must not write to the old
+  // pages while they are copied. Their faults wait for page_table_lock.
+  if (lv3_table) {
+    lv2_table[LV2_INDEX(base)] = 0;
+    flush_guest_tlb();
+  }
+
+  for (int i = 0; i < PTRS_PER_TABLE; i++) {
+    void *dst = (void *)TO_VADDR(block + i * PAGE_SIZE);
+    if (lv3_table && lv3_table[i]) {
+      void *src = (void *)TO_VADDR((lv3_table[i] & PAGE_MASK));
+      // the guest may have written it without caches
+      flush_dcache_range(src, PAGE_SIZE);
+      memcpy(dst, src, PAGE_SIZE);
+    } else {
+      memzero(dst, PAGE_SIZE);
+    }
+  }
+  flush_dcache_range((void *)TO_VADDR(block), SECTION_SIZE);
+
+  if (lv3_table) {
+    for (int i = 0; i < PTRS_PER_TABLE; i++) {
+      if (lv3_table[i])
+        free_page(lv3_table[i] & PAGE_MASK);
+    }
+    free_page(TO_PADDR(lv3_table));
+    mm->kernel_pages_count--;
+    mm->user_pages_count -= mapped;
+    mm->page_mappings_count -= mapped;
+  }
+
+  lv2_table[LV2_INDEX(base)] = block | MMU_STAGE2_BLOCK_FLAGS;
+  if (lv3_table)
+    invalidate_icache();
+  mm->user_pages_count += PTRS_PER_TABLE;
+  mm->block_mappings_count++;
+  return PTRS_PER_TABLE - mapped;
+}
+
+static int stage2_block_threshold(struct mm_struct *mm) {
+  switch (mm->block_policy) {
+  case STAGE2_BLOCK_ALWAYS:
+    return 0;
+  case STAGE2_BLOCK_ON_THRESHOLD:
+    return mm->block_threshold;
+  }
+  return -1;
+}
+
+// Guests running with their MMU off access memory without caches, so the
+// page must not have dirty lines left by the hypervisor.
+static void map_guest_page(struct vm_struct *vm, vaddr_t va, paddr_t page) {
+  flush_dcache_range((void *)TO_VADDR(page), PAGE_SIZE);
+  map_stage2_page(vm, va, page, MMU_STAGE2_PAGE_FLAGS);
+  vm->mm.page_mappings_count++;
+}
+
+// maps [start, start + npages) except the pages which are already mapped
+static int map_stage2_unmapped_pages(struct vm_struct *vm, vaddr_t start,
+                                     int npages) {
+  uint64_t *lv3_table = (uint64_t *)TO_VADDR(get_stage2_lv3_table(vm, start));
+  int count = 0;
+  for (int i = 0; i < npages; i++) {
+    vaddr_t va = start + i * PAGE_SIZE;
+    if (lv3_table[(va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1)])
+      continue;
+    paddr_t page = get_free_page();
+    if (page == 0)
+      break;
+    map_guest_page(vm, va, page);
+    count++;
+  }
+  return count;
+}
+
+// maps the neighbours of the faulting page in the same fault-around window
+static int fault_around(struct vm_struct *vm, vaddr_t ipa) {
+  int n = vm->mm.fault_around_pages;
+  if (n <= 1)
+    return 0;
+  vaddr_t start = ipa & ~((vaddr_t)n * PAGE_SIZE - 1);
+  if (start + n * PAGE_SIZE > DEVICE_BASE)
+    return 0;
+  return map_stage2_unmapped_pages(vm, start, n);
+}
+
+// Maps the first prefault_size bytes of the guest memory in advance.
+// Returns the number of pages mapped.
+int prefault_stage2(struct vm_struct *vm) {
+  vaddr_t end = MIN(vm->mm.prefault_size, (unsigned long)DEVICE_BASE);
+  vaddr_t va = 0;
+  int count = 0;
+  spin_lock(&vm->mm.page_table_lock);
+  while (va < end) {
+    int n;
+    uint64_t entry = get_stage2_entry(vm, va);
+    if (entry && (entry & 0x3) == MM_TYPE_BLOCK) {
+      // mapped by a block already
+      va = (va & ~((vaddr_t)SECTION_SIZE - 1)) + SECTION_SIZE;
+      continue;
+    }
+    if ((va & (SECTION_SIZE - 1)) == 0 && va + SECTION_SIZE <= end &&
+        vm->mm.block_policy != STAGE2_BLOCK_NEVER &&
+        (n = map_stage2_block(vm, va, 0)) >= 0) {
+      count += n;
+      va += SECTION_SIZE;
+      continue;
+    }
+    vaddr_t next = MIN((va & ~((vaddr_t)SECTION_SIZE - 1)) + SECTION_SIZE, end);
+    int npages = (next - va + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    count += map_stage2_unmapped_pages(vm, va, npages);
+    va = next;
+  }
+  spin_unlock(&vm->mm.page_table_lock);
+  return count;
 }
 
 paddr_t get_ipa(vaddr_t va) {
@@ -110,23 +323,48 @@ paddr_t get_ipa(vaddr_t va) {
 
 int handle_mem_abort(vaddr_t addr, uint64_t esr) {
   struct pt_regs *regs = task_pt_regs(current);
+  struct vm_struct *vm = current->vm;
   uint64_t dfsc = esr & ISS_ABORT_DFSC_MASK;
 
+  if (exit_sites_enabled)
+    exit_site_record(regs->pc, (esr >> 26) & 0x3f, get_ipa(addr) & PAGE_MASK);
+
   if (dfsc >> 2 == 0x1) {
     // translation fault
+    vaddr_t ipa = get_ipa(addr) & PAGE_MASK;
+    current->stat.pf_count++;
+
+    // another vCPU may have mapped it in the meantime
+    spin_lock(&vm->mm.page_table_lock);
+    if (get_stage2_entry(vm, ipa)) {
+      spin_unlock(&vm->mm.page_table_lock);
+      return 0;
+    }
+
+    int n = map_stage2_block(vm, ipa, stage2_block_threshold(&vm->mm));
+    if (n >= 0) {
+      spin_unlock(&vm->mm.page_table_lock);
+      current->stat.pf_avoided_count += n - 1;
+      return 0;
+    }
+
     paddr_t page = get_free_page();
     if (page == 0) {
+      spin_unlock(&vm->mm.page_table_lock);
       return -1;
     }
-    map_stage2_page(current, get_ipa(addr) & PAGE_MASK, page, MMU_STAGE2_PAGE_FLAGS);
-    current->stat.pf_count++;
+    map_guest_page(vm, ipa, page);
+    current->stat.pf_avoided_count += fault_around(vm, ipa);
+    spin_unlock(&vm->mm.page_table_lock);
     return 0;
   } else if (dfsc >> 2 == 0x3) {
     // permission fault (mmio)
-    const struct board_ops *ops = current->board_ops;
+    const struct board_ops *ops = vm->board_ops;
     //int sas = (esr >> 22) & 0x3;
     unsigned int srt = (esr >> 16) & 0x1f;
     unsigned int wnr = (esr >> 6) & 0x1;
+    // the board state is shared by the vCPUs
+    spin_lock(&vm->lock);
     if (wnr == 0) {
       if (HAVE_FUNC(ops, mmio_read))
         regs->regs[srt] = ops->mmio_read(current, get_ipa(addr));
@@ -134,6 +372,8 @@ int handle_mem_abort(vaddr_t addr, uint64_t esr) {
       if (HAVE_FUNC(ops, mmio_write))
         ops->mmio_write(current, get_ipa(addr), regs->regs[srt]);
     }
+    spin_unlock(&vm->lock);
+    exit_stat_set_mmio(regs->regs[srt]);
 
     increment_current_pc(4);
     current->stat.mmio_count++;
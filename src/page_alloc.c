@@ -0,0 +1,290 @@
+#include "utils.h"
+#include "debug.h"
+#include "mm.h"
+#include "spinlock.h"
+
+// buddy allocator
+//   mem_map[i] holds the state of the block whose first page is i.
+//   Pages in the middle of a block are left as 0.
+#define PAGE_FREE       0x8000
+#define PAGE_ALLOCATED  0x4000
+#define PAGE_POOLED     0x2000 // in zero pool or dirty list
+#define PAGE_ORDER_MASK 0x00ff
+
+#define PAGE_INDEX(p) (((p) - LOW_MEMORY) >> PAGE_SHIFT)
+#define INDEX_TO_PAGE(i) (LOW_MEMORY + ((paddr_t)(i) << PAGE_SHIFT))
+
+// list node is stored in the first bytes of each free block
+struct free_block {
+  struct free_block *next;
+  struct free_block *prev;
+};
+
+struct free_area {
+  struct free_block *head;
+  unsigned long nr_free;
+};
+
+// singly linked list of order-0 pages
+struct page_list {
+  struct free_block *head;
+  unsigned long count;
+};
+
+// protects mem_map, free_area, zero_pool and dirty_list
+static spinlock_t mm_lock;
+
+static unsigned short mem_map[PAGING_PAGES] = { 0 };
+static struct free_area free_area[MAX_ORDER];
+
+// pre-zeroed pages refilled by the idle task, and freed pages waiting for it
+static struct page_list zero_pool;
+static struct page_list dirty_list;
+static int zero_pool_refilling = 0;
+
+static struct {
+  long hit;
+  long miss;
+  long refilled;
+} zero_pool_stat;
+
+static void add_free_block(unsigned long index, int order) {
+  struct free_block *b = (struct free_block *)TO_VADDR(INDEX_TO_PAGE(index));
+  struct free_area *area = &free_area[order];
+  b->prev = 0;
+  b->next = area->head;
+  if (area->head)
+    area->head->prev = b;
+  area->head = b;
+  area->nr_free++;
+  mem_map[index] = PAGE_FREE | order;
+}
+
+static void del_free_block(unsigned long index, int order) {
+  struct free_block *b = (struct free_block *)TO_VADDR(INDEX_TO_PAGE(index));
+  struct free_area *area = &free_area[order];
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    area->head = b->next;
+  if (b->next)
+    b->next->prev = b->prev;
+  area->nr_free--;
+  mem_map[index] = 0;
+}
+
+static void push_page(struct page_list *list, paddr_t page) {
+  struct free_block *b = (struct free_block *)TO_VADDR(page);
+  b->next = list->head;
+  list->head = b;
+  list->count++;
+}
+
+static paddr_t pop_page(struct page_list *list) {
+  struct free_block *b = list->head;
+  if (!b)
+    return 0;
+  list->head = b->next;
+  list->count--;
+  return TO_PADDR(b);
+}
+
+void mm_init(void) {
+  // pushing from the top leaves the lowest block at the head of each list
+  unsigned long index = PAGING_PAGES;
+  while (index > 0) {
+    int order = MAX_ORDER - 1;
+    while ((index & ((1UL << order) - 1)) != 0 || (1UL << order) > index)
+      order--;
+    index -= 1UL << order;
+    add_free_block(index, order);
+  }
+}
+
+void *allocate_page() {
+  paddr_t page = get_free_page();
+  if (page == 0) {
+    return 0;
+  }
+  return (void *)TO_VADDR(page);
+}
+
+void *allocate_pages(int order) {
+  paddr_t page = get_free_pages(order);
+  if (page == 0) {
+    return 0;
+  }
+  memzero((void *)TO_VADDR(page), PAGE_SIZE << order);
+  return (void *)TO_VADDR(page);
+}
+
+void deallocate_page(void *page) {
+  free_page(TO_PADDR(page));
+}
+
+static paddr_t alloc_block(int order) {
+  int current_order;
+  for (current_order = order; current_order < MAX_ORDER; current_order++) {
+    if (free_area[current_order].head)
+      break;
+  }
+  if (current_order == MAX_ORDER)
+    return 0;
+
+  paddr_t page = TO_PADDR(free_area[current_order].head);
+  unsigned long index = PAGE_INDEX(page);
+  del_free_block(index, current_order);
+
+  // split and return the upper halves to the free lists
+  while (current_order > order) {
+    current_order--;
+    add_free_block(index + (1UL << current_order), current_order);
+  }
+
+  mem_map[index] = PAGE_ALLOCATED | order;
+  return page;
+}
+
+static void free_pages_locked(paddr_t p);
+
+// give pooled pages back to the buddy allocator so that they can merge
+static void drain_page_list(struct page_list *list) {
+  paddr_t page;
+  while ((page = pop_page(list)) != 0) {
+    mem_map[PAGE_INDEX(page)] = PAGE_ALLOCATED;
+    free_pages_locked(page);
+  }
+}
+
+static paddr_t get_free_pages_locked(int order) {
+  paddr_t page = alloc_block(order);
+  if (page == 0 && (dirty_list.count || zero_pool.count)) {
+    drain_page_list(&dirty_list);
+    drain_page_list(&zero_pool);
+    page = alloc_block(order);
+  }
+  return page;
+}
+
+// returns 2^order contiguous pages (not cleared)
+paddr_t get_free_pages(int order) {
+  unsigned long flags = spin_lock_irqsave(&mm_lock);
+  paddr_t page = get_free_pages_locked(order);
+  spin_unlock_irqrestore(&mm_lock, flags);
+  return page;
+}
+
+void free_pages(paddr_t p) {
+  unsigned long flags = spin_lock_irqsave(&mm_lock);
+  free_pages_locked(p);
+  spin_unlock_irqrestore(&mm_lock, flags);
+}
+
+static void free_pages_locked(paddr_t p) {
+  unsigned long index = PAGE_INDEX(p);
+  if (!(mem_map[index] & PAGE_ALLOCATED)) {
+    WARN("freeing a page which is not allocated: %lx", p);
+    return;
+  }
+  int order = mem_map[index] & PAGE_ORDER_MASK;
+  mem_map[index] = 0;
+
+  // merge with the buddy as long as it is free
+  while (order < MAX_ORDER - 1) {
+    unsigned long buddy = index ^ (1UL << order);
+    if (buddy >= PAGING_PAGES || mem_map[buddy] != (PAGE_FREE | order))
+      break;
+    del_free_block(buddy, order);
+    index &= ~(1UL << order);
+    order++;
+  }
+  add_free_block(index, order);
+}
+
+// returns a zero-cleared page, taken from the zero pool if possible
+paddr_t get_free_page() {
+  unsigned long flags = spin_lock_irqsave(&mm_lock);
+  paddr_t page = pop_page(&zero_pool);
+  if (page) {
+    // only the list link has to be cleared
+    ((struct free_block *)TO_VADDR(page))->next = 0;
+    mem_map[PAGE_INDEX(page)] = PAGE_ALLOCATED;
+    zero_pool_stat.hit++;
+    spin_unlock_irqrestore(&mm_lock, flags);
+    return page;
+  }
+
+  zero_pool_stat.miss++;
+  page = pop_page(&dirty_list);
+  if (page)
+    mem_map[PAGE_INDEX(page)] = PAGE_ALLOCATED;
+  else
+    page = get_free_pages_locked(0);
+  spin_unlock_irqrestore(&mm_lock, flags);
+  if (page == 0) {
+    PANIC("no free pages!");
+    return 0;
+  }
+  memzero((void *)TO_VADDR(page), PAGE_SIZE);
+  return page;
+}
+
+// single pages are kept on the dirty list to be cleared by the idle task
+void free_page(paddr_t p) {
+  unsigned long index = PAGE_INDEX(p);
+  unsigned long flags = spin_lock_irqsave(&mm_lock);
+  if (mem_map[index] != PAGE_ALLOCATED || dirty_list.count >= ZERO_POOL_HIGH) {
+    free_pages_locked(p);
+  } else {
+    mem_map[index] = PAGE_POOLED;
+    push_page(&dirty_list, p);
+  }
+  spin_unlock_irqrestore(&mm_lock, flags);
+}
+
+// Called by the idle task of each CPU with IRQs enabled. Starts refilling
+// when the pool drops below ZERO_POOL_LOW and stops at ZERO_POOL_HIGH.
+// Pages are cleared without holding mm_lock so that VMs are not delayed
+// by the idle tasks.
+// Returns the number of pages cleared (0 when there is nothing to do).
+int refill_zero_pool(void) {
+  int i;
+  for (i = 0; i < ZERO_POOL_BATCH; i++) {
+    unsigned long flags = spin_lock_irqsave(&mm_lock);
+    if (zero_pool.count < ZERO_POOL_LOW)
+      zero_pool_refilling = 1;
+    else if (zero_pool.count >= ZERO_POOL_HIGH)
+      zero_pool_refilling = 0;
+
+    paddr_t page = 0;
+    if (zero_pool_refilling) {
+      page = pop_page(&dirty_list);
+      if (page == 0)
+        page = alloc_block(0);
+    }
+    if (page)
+      mem_map[PAGE_INDEX(page)] = PAGE_POOLED;
+    spin_unlock_irqrestore(&mm_lock, flags);
+
+    if (page == 0)
+      break;
+
+    memzero((void *)TO_VADDR(page), PAGE_SIZE);
+
+    flags = spin_lock_irqsave(&mm_lock);
+    push_page(&zero_pool, page);
+    zero_pool_stat.refilled++;
+    spin_unlock_irqrestore(&mm_lock, flags);
+  }
+  return i;
+}
+
+void show_free_area_info(void) {
+  printf("%5s %7s\n", "order", "free");
+  for (int i = 0; i < MAX_ORDER; i++) {
+    printf("%5d %7lu\n", i, free_area[i].nr_free);
+  }
+  printf("zero pool: %lu pages (hit %ld, miss %ld, refilled %ld), dirty: %lu pages\n",
+      zero_pool.count, zero_pool_stat.hit, zero_pool_stat.miss,
+      zero_pool_stat.refilled, dirty_list.count);
+}
@@ -0,0 +1,274 @@
+#include "pmu.h"
+#include "peripherals/local.h"
+#include "arm/sysregs.h"
+#include "sched.h"
+#include "task.h"
+#include "mm.h"
+#include "smp.h"
+#include "utils.h"
+#include "debug.h"
+
+// A vCPU gets its own PMU registers when it first accesses any of them.
+// Until then, accesses are trapped by MDCR_EL2.TPM. The registers of the
+// running vCPU are live in the CPU. They are saved with the counters
+// stopped when it is switched out, so the counts of a vCPU do not include
+// other VMs (nor EL2, unless the guest sets the NSH filter bits).
+//
+// An overflow raises the PMU interrupt of the CPU at EL2, which is passed
+// to the vCPU as a virtual IRQ. The emulated interrupt controller has no
+// PMU source, so the guest finds the overflow in PMOVSSET_EL0. Until the
+// guest clears it, the PMU interrupt of the CPU is masked and the PMU
+// registers are trapped and emulated, so that the virtual IRQ is dropped
+// as soon as it is handled.
+
+#define read_sysreg(r) ({ \
+  unsigned long __v; \
+  asm volatile("mrs %0, " #r : "=r"(__v)); \
+  __v; \
+})
+#define write_sysreg(v, r) \
+  asm volatile("msr " #r ", %0" : : "r"((unsigned long)(v)))
+#define isb() asm volatile("isb" : : : "memory")
+
+#define PMU_ALL_COUNTERS 0xffffffffUL // event counters and PMCCNTR
+
+static int nr_counters;
+// the PMU registers of current are loaded on each CPU
+static int pmu_loaded[NR_CPUS];
+
+void pmu_init(void) {
+  nr_counters = (read_sysreg(pmcr_el0) >> PMCR_N_SHIFT) & PMCR_N_MASK;
+  INFO("%d PMU event counters", nr_counters);
+}
+
+static void pmu_save(struct pmu_state *s) {
+  s->pmcr = read_sysreg(pmcr_el0);
+  write_sysreg(s->pmcr & ~PMCR_E, pmcr_el0); // stop the counters
+  isb();
+  s->pmcntenset = read_sysreg(pmcntenset_el0);
+  s->pmintenset = read_sysreg(pmintenset_el1);
+  s->pmovsset = read_sysreg(pmovsset_el0);
+  s->pmselr = read_sysreg(pmselr_el0);
+  s->pmuserenr = read_sysreg(pmuserenr_el0);
+  s->pmccntr = read_sysreg(pmccntr_el0);
+  s->pmccfiltr = read_sysreg(pmccfiltr_el0);
+  for (int i = 0; i < nr_counters; i++) {
+    write_sysreg(i, pmselr_el0);
+    isb();
+    s->pmevcntr[i] = read_sysreg(pmxevcntr_el0);
+    s->pmevtyper[i] = read_sysreg(pmxevtyper_el0);
+  }
+  write_sysreg(PMU_ALL_COUNTERS, pmcntenclr_el0);
+  write_sysreg(PMU_ALL_COUNTERS, pmintenclr_el1);
+  write_sysreg(PMU_ALL_COUNTERS, pmovsclr_el0);
+  isb();
+}
+
+static void pmu_restore(struct pmu_state *s) {
+  write_sysreg(PMU_ALL_COUNTERS, pmcntenclr_el0);
+  write_sysreg(PMU_ALL_COUNTERS, pmintenclr_el1);
+  write_sysreg(PMU_ALL_COUNTERS, pmovsclr_el0);
+  for (int i = 0; i < nr_counters; i++) {
+    write_sysreg(i, pmselr_el0);
+    isb();
+    write_sysreg(s->pmevcntr[i], pmxevcntr_el0);
+    write_sysreg(s->pmevtyper[i], pmxevtyper_el0);
+  }
+  write_sysreg(s->pmccntr, pmccntr_el0);
+  write_sysreg(s->pmccfiltr, pmccfiltr_el0);
+  write_sysreg(s->pmselr, pmselr_el0);
+  write_sysreg(s->pmuserenr, pmuserenr_el0);
+  write_sysreg(s->pmovsset, pmovsset_el0);
+  write_sysreg(s->pmintenset, pmintenset_el1);
+  write_sysreg(s->pmcntenset, pmcntenset_el0);
+  isb();
+  write_sysreg(s->pmcr, pmcr_el0); // start the counters
+  isb();
+}
+
+static int overflow_pending(unsigned long pmcr, unsigned long ovs,
+                            unsigned long inten) {
+  return (pmcr & PMCR_E) && (ovs & inten);
+}
+
+static int live_overflow_pending(void) {
+  return overflow_pending(read_sysreg(pmcr_el0), read_sysreg(pmovsset_el0),
+                          read_sysreg(pmintenset_el1));
+}
+
+// the virtual IRQ of tsk is asserted for its PMU overflow
+int pmu_irq_pending(struct task_struct *tsk) {
+  struct pmu_state *s = tsk->pmu;
+  if (!s)
+    return 0;
+  if (tsk == current && pmu_loaded[smp_processor_id()])
+    return live_overflow_pending();
+  return overflow_pending(s->pmcr, s->pmovsset, s->pmintenset);
+}
+
+static void set_pmu_trap(int trap) {
+  unsigned long mdcr = read_sysreg(mdcr_el2);
+  write_sysreg(trap ? mdcr | MDCR_TPM : mdcr & ~MDCR_TPM, mdcr_el2);
+  isb();
+}
+
+// called with the PMU registers of current loaded
+static void update_pmu_irq(void) {
+  int cpu = smp_processor_id();
+  if (live_overflow_pending()) {
+    put32(CORE_PMU_IRQ_CLR, 1 << cpu);
+    set_pmu_trap(1);
+  } else {
+    set_pmu_trap(0);
+    put32(CORE_PMU_IRQ_SET, 1 << cpu);
+  }
+}
+
+void pmu_switch_to(struct task_struct *prev, struct task_struct *next) {
+  int cpu = smp_processor_id();
+  if (pmu_loaded[cpu]) {
+    pmu_save(prev->pmu);
+    pmu_loaded[cpu] = 0;
+  }
+  if (!next->vm)
+    return;
+  if (next->pmu) {
+    pmu_restore(next->pmu);
+    pmu_loaded[cpu] = 1;
+    update_pmu_irq();
+  } else {
+    set_pmu_trap(1);
+  }
+}
+
+#define ESR_OP0(esr) (((esr) >> 20) & 0x3)
+#define ESR_OP2(esr) (((esr) >> 17) & 0x7)
+#define ESR_OP1(esr) (((esr) >> 14) & 0x7)
+#define ESR_CRN(esr) (((esr) >> 10) & 0xf)
+#define ESR_RT(esr)  (((esr) >> 5) & 0x1f)
+#define ESR_CRM(esr) (((esr) >> 1) & 0xf)
+#define ESR_DIR(esr) ((esr) & 0x1) // 1: read
+
+// ESR_EL2 of a trapped MSR/MRS
+int is_pmu_sysreg(unsigned long esr) {
+  unsigned int op0 = ESR_OP0(esr), op1 = ESR_OP1(esr);
+  unsigned int crn = ESR_CRN(esr), crm = ESR_CRM(esr);
+  if (op0 != 3)
+    return 0;
+  if (crn == 9)
+    return (op1 == 3 && crm >= 12 && crm <= 14) || (op1 == 0 && crm == 14);
+  return crn == 14 && op1 == 3 && crm >= 8;
+}
+
+#define PMU_REG(op1, crm, op2) (((op1) << 8) | ((crm) << 4) | (op2))
+
+#define ACCESS_SYSREG(name) do { \
+  if (dir) \
+    *val = read_sysreg(name); \
+  else \
+    write_sysreg(*val, name); \
+} while (0)
+
+// PMEVCNTR<n>_EL0 and PMEVTYPER<n>_EL0 through PMSELR_EL0
+static void access_event_reg(int n, int type, int dir, unsigned long *val) {
+  if (n >= nr_counters) {
+    if (dir)
+      *val = 0;
+    return;
+  }
+  unsigned long sel = read_sysreg(pmselr_el0);
+  write_sysreg(n, pmselr_el0);
+  isb();
+  if (type)
+    ACCESS_SYSREG(pmxevtyper_el0);
+  else
+    ACCESS_SYSREG(pmxevcntr_el0);
+  write_sysreg(sel, pmselr_el0);
+}
+
+static void access_pmu_reg(unsigned long esr, unsigned long *val) {
+  unsigned int op1 = ESR_OP1(esr), op2 = ESR_OP2(esr);
+  unsigned int crn = ESR_CRN(esr), crm = ESR_CRM(esr);
+  int dir = ESR_DIR(esr);
+
+  if (crn == 14) {
+    int n = ((crm & 3) << 3) | op2;
+    if (n == 31)
+      ACCESS_SYSREG(pmccfiltr_el0);
+    else
+      access_event_reg(n, crm >= 12, dir, val);
+    return;
+  }
+
+  switch (PMU_REG(op1, crm, op2)) {
+  case PMU_REG(3, 12, 0): ACCESS_SYSREG(pmcr_el0); break;
+  case PMU_REG(3, 12, 1): ACCESS_SYSREG(pmcntenset_el0); break;
+  case PMU_REG(3, 12, 2): ACCESS_SYSREG(pmcntenclr_el0); break;
+  case PMU_REG(3, 12, 3): ACCESS_SYSREG(pmovsclr_el0); break;
+  case PMU_REG(3, 12, 4):
+    if (!dir)
+      write_sysreg(*val, pmswinc_el0);
+    break;
+  case PMU_REG(3, 12, 5): ACCESS_SYSREG(pmselr_el0); break;
+  case PMU_REG(3, 12, 6):
+    if (dir)
+      *val = read_sysreg(pmceid0_el0);
+    break;
+  case PMU_REG(3, 12, 7):
+    if (dir)
+      *val = read_sysreg(pmceid1_el0);
+    break;
+  case PMU_REG(3, 13, 0): ACCESS_SYSREG(pmccntr_el0); break;
+  case PMU_REG(3, 13, 1): ACCESS_SYSREG(pmxevtyper_el0); break;
+  case PMU_REG(3, 13, 2): ACCESS_SYSREG(pmxevcntr_el0); break;
+  case PMU_REG(3, 14, 0): ACCESS_SYSREG(pmuserenr_el0); break;
+  case PMU_REG(3, 14, 3): ACCESS_SYSREG(pmovsset_el0); break;
+  case PMU_REG(0, 14, 1): ACCESS_SYSREG(pmintenset_el1); break;
+  case PMU_REG(0, 14, 2): ACCESS_SYSREG(pmintenclr_el1); break;
+  default:
+    if (dir)
+      *val = 0;
+    break;
+  }
+  isb();
+}
+
+void handle_trap_pmu(unsigned long esr) {
+  int cpu = smp_processor_id();
+  struct pt_regs *regs = task_pt_regs(current);
+  unsigned int rt = ESR_RT(esr);
+
+  if (!pmu_loaded[cpu]) {
+    // first access: the instruction is executed again without the trap
+    if (!current->pmu)
+      current->pmu = (struct pmu_state *)allocate_page();
+    if (current->pmu) {
+      pmu_restore(current->pmu);
+      pmu_loaded[cpu] = 1;
+      update_pmu_irq();
+      return;
+    }
+    WARN("failed to allocate the PMU registers");
+    if (ESR_DIR(esr) && rt != 31)
+      regs->regs[rt] = 0;
+    increment_current_pc(4);
+    return;
+  }
+
+  // an overflow is pending
+  unsigned long val = rt == 31 ? 0 : regs->regs[rt];
+  access_pmu_reg(esr, &val);
+  if (ESR_DIR(esr) && rt != 31)
+    regs->regs[rt] = val;
+  increment_current_pc(4);
+  update_pmu_irq();
+}
+
+// the overflow is passed to current by set_cpu_virtual_interrupt()
+void handle_pmu_irq(void) {
+  int cpu = smp_processor_id();
+  if (pmu_loaded[cpu])
+    update_pmu_irq();
+  else
+    put32(CORE_PMU_IRQ_CLR, 1 << cpu); // unmasked again by the next vCPU using the PMU
+}
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include "printf.h"
+#include "spinlock.h"
 
 typedef void (*putcf)(void *, char);
 static putcf stdout_putf;
@@ -31,7 +32,7 @@ static void *stdout_putp;
 
 static void uli2a(unsigned long int num, unsigned int base, int uc, char *bf) {
   int n = 0;
-  unsigned int d = 1;
+  unsigned long int d = 1;
   while (num / d >= base)
     d *= base;
   while (d != 0) {
@@ -120,7 +121,7 @@ static void putchw(void *putp, putcf putf, int n, char z, char *bf) {
 }
 
 void tfp_format(void *putp, putcf putf, char *fmt, va_list va) {
-  char bf[12];
+  char bf[24]; // 64-bit decimal with the sign
 
   char ch;
 
@@ -201,13 +202,27 @@ void init_printf(void *putp, void (*putf)(void *, char)) {
   stdout_putp = putp;
 }
 
+// keeps the output of a printf() call from being mixed with other CPUs'
+static spinlock_t stdout_lock;
+
 void tfp_printf(char *fmt, ...) {
   va_list va;
   va_start(va, fmt);
+  unsigned long flags = spin_lock_irqsave(&stdout_lock);
   tfp_format(stdout_putp, stdout_putf, fmt, va);
+  spin_unlock_irqrestore(&stdout_lock, flags);
   va_end(va);
 }
 
+// for writing other than printf() to the console without being mixed
+unsigned long lock_stdout(void) {
+  return spin_lock_irqsave(&stdout_lock);
+}
+
+void unlock_stdout(unsigned long flags) {
+  spin_unlock_irqrestore(&stdout_lock, flags);
+}
+
 static void putcp(void *p, char c) { *(*((char **)p))++ = c; }
 
 void tfp_sprintf(char *s, char *fmt, ...) {
@@ -0,0 +1,150 @@
+#include "profile.h"
+#include "sched.h"
+#include "task.h"
+#include "mm.h"
+#include "smp.h"
+#include "timer.h"
+#include "utils.h"
+#include "printf.h"
+
+_Static_assert(sizeof(struct vm_profile) <= (PAGE_SIZE << PROFILE_ORDER),
+               "vm_profile does not fit in PROFILE_ORDER");
+
+// Samples are taken on the scheduler tick, which keeps running while
+// profiling is on (see need_sched_tick()), so the period is a multiple
+// of SCHED_TICK.
+volatile int profile_enabled;
+static int period_ticks;
+static int ticks_to_sample[NR_CPUS];
+
+// histograms are allocated the first time profiling is enabled
+static int allocate_profiles(void) {
+  int n = __atomic_load_n(&nr_vms, __ATOMIC_ACQUIRE);
+  for (int i = 1; i < n; i++) {
+    struct vm_struct *vm = vms[i];
+    if (vm->profile)
+      continue;
+    vm->profile = (struct vm_profile *)allocate_pages(PROFILE_ORDER);
+    if (!vm->profile)
+      return -1;
+  }
+  return 0;
+}
+
+static void clear_profiles(void) {
+  for (int i = 1; i < nr_vms; i++) {
+    struct vm_profile *prof = vms[i]->profile;
+    if (!prof)
+      continue;
+    // a CPU may still be sampling if it saw profile_enabled set
+    spin_lock(&prof->lock);
+    prof->nr_samples = 0;
+    prof->dropped = 0;
+    memzero(prof->slots, sizeof(prof->slots));
+    spin_unlock(&prof->lock);
+  }
+}
+
+// period in ms, 0 turns profiling off. The samples are cleared when
+// profiling is turned on.
+int set_profile_period(int ms) {
+  if (ms < 0)
+    return -1;
+  if (ms == 0) {
+    profile_enabled = 0; // the ticks are stopped lazily
+    return 0;
+  }
+  if (allocate_profiles() < 0)
+    return -1;
+  if (!profile_enabled)
+    clear_profiles();
+  period_ticks = (ms * 1000 + SCHED_TICK - 1) / SCHED_TICK;
+  __atomic_store_n(&profile_enabled, 1, __ATOMIC_RELEASE);
+
+  // start the ticks of the CPUs running a single task
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    if (cpu == smp_processor_id())
+      update_sched_tick(need_sched_tick());
+    else
+      send_ipi(cpu);
+  }
+  return 0;
+}
+
+static unsigned int hash_sample(unsigned long pc, unsigned int el) {
+  return (((pc >> 2) ^ el) * 0x9e3779b97f4a7c15UL) >> (64 - PROFILE_SLOTS_SHIFT);
+}
+
+static void add_sample(struct vm_profile *prof, unsigned long pc,
+                       unsigned int el, unsigned long elr) {
+  unsigned int h = hash_sample(pc, el);
+  spin_lock(&prof->lock);
+  prof->nr_samples++;
+  for (int i = 0; i < PROFILE_MAX_PROBES; i++) {
+    struct prof_sample *s = &prof->slots[(h + i) & (PROFILE_SLOTS - 1)];
+    if (s->count == 0) {
+      s->pc = pc;
+      s->el = el;
+    } else if (s->pc != pc || s->el != el) {
+      continue;
+    }
+    s->count++;
+    if (el == 1)
+      s->elr = elr;
+    spin_unlock(&prof->lock);
+    return;
+  }
+  prof->dropped++;
+  spin_unlock(&prof->lock);
+}
+
+// called on the scheduler tick before switching tasks
+void profile_tick(void) {
+  if (!profile_enabled)
+    return;
+  int cpu = smp_processor_id();
+  if (--ticks_to_sample[cpu] > 0)
+    return;
+  ticks_to_sample[cpu] = period_ticks;
+
+  struct task_struct *p = current;
+  if (!p->vm || !p->vm->profile)
+    return;
+  struct pt_regs *regs = task_pt_regs(p);
+  unsigned int el = (regs->pstate >> 2) & 3;
+  if (el > 1)
+    return; // not taken from the guest
+  // at EL1, ELR_EL1 is the return address of the exception being handled
+  // by the guest, if any. The EL1 registers of the vCPU are still loaded.
+  add_sample(p->vm->profile, regs->pc, el, el == 1 ? get_elr_el1() : 0);
+}
+
+// Prints the samples as text, which tools/symbolize_profile.py matches
+// against the symbols of the guest images:
+//   profile <vm> <name> <samples> <dropped> <period ms>
+//   <pc> <el> <count> <elr>
+//   ...
+//   end
+// Profiling is paused while dumping.
+void dump_profile(void) {
+  int was_enabled = profile_enabled;
+  profile_enabled = 0;
+
+  printf("\n");
+  for (int i = 1; i < nr_vms; i++) {
+    struct vm_struct *vm = vms[i];
+    struct vm_profile *prof = vm->profile;
+    if (!prof)
+      continue;
+    printf("profile %d %s %ld %ld %d\n", vm->id, vm->name ? vm->name : "-",
+           prof->nr_samples, prof->dropped, period_ticks * SCHED_TICK / 1000);
+    for (int j = 0; j < PROFILE_SLOTS; j++) {
+      struct prof_sample *s = &prof->slots[j];
+      if (s->count)
+        printf("%lx %d %d %lx\n", s->pc, s->el, s->count, s->elr);
+    }
+    printf("end\n");
+  }
+
+  profile_enabled = was_enabled;
+}
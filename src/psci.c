@@ -0,0 +1,132 @@
+#include "psci.h"
+#include "sched.h"
+#include "task.h"
+#include "debug.h"
+#include "spinlock.h"
+
+#define MPIDR_HWID_MASK 0xff00ffffffUL
+
+int is_psci_call(unsigned long fn) {
+  fn &= ~(unsigned long)PSCI_0_2_64BIT;
+  return fn >= PSCI_0_2_FN_BASE && fn <= PSCI_0_2_FN(0x1f);
+}
+
+static struct task_struct *find_vcpu(struct vm_struct *vm,
+                                     unsigned long mpidr) {
+  for (int i = 0; i < vm->nr_vcpus; i++) {
+    struct task_struct *p = vm->vcpus[i];
+    if ((p->cpu_sysregs.mpidr_el1 & MPIDR_HWID_MASK) ==
+        (mpidr & MPIDR_HWID_MASK))
+      return p;
+  }
+  return 0;
+}
+
+static long psci_cpu_on(unsigned long target, unsigned long entry,
+                        unsigned long context_id) {
+  struct vm_struct *vm = current->vm;
+  struct task_struct *p = find_vcpu(vm, target);
+  if (!p)
+    return PSCI_RET_INVALID_PARAMETERS;
+
+  spin_lock(&vm->lock);
+  if (p->state != TASK_STOPPED) {
+    spin_unlock(&vm->lock);
+    return PSCI_RET_ALREADY_ON;
+  }
+
+  // the vCPU starts at entry with its MMU off, as after a reset
+  struct pt_regs *regs = task_pt_regs(p);
+  for (int i = 0; i < 31; i++)
+    regs->regs[i] = 0;
+  regs->regs[0] = context_id;
+  regs->pc = entry;
+  regs->pstate = PSR_MODE_EL1h | (0xf << 6); // interrupt mask
+  reset_vcpu_sysregs(p);
+
+  p->state = TASK_RUNNING;
+  enqueue_task(p);
+  spin_unlock(&vm->lock);
+  return PSCI_RET_SUCCESS;
+}
+
+// returns only after the vCPU is powered on again by CPU_ON
+static void psci_cpu_off(void) {
+  struct vm_struct *vm = current->vm;
+  spin_lock(&vm->lock);
+  // its EL1 registers are reset by CPU_ON, they need not be saved
+  put_cpu_sysregs(current);
+  current->state = TASK_STOPPED;
+  dequeue_task(current);
+  spin_unlock(&vm->lock);
+  _schedule();
+}
+
+static long psci_affinity_info(unsigned long target, unsigned long level) {
+  if (level != 0)
+    return PSCI_RET_INVALID_PARAMETERS;
+  struct task_struct *p = find_vcpu(current->vm, target);
+  if (!p)
+    return PSCI_RET_INVALID_PARAMETERS;
+  return p->state == TASK_STOPPED ? PSCI_AFFINITY_OFF : PSCI_AFFINITY_ON;
+}
+
+static long psci_features(unsigned long fn) {
+  switch (fn) {
+  case PSCI_VERSION:
+  case PSCI_CPU_OFF:
+  case PSCI_CPU_ON:
+  case PSCI_CPU_ON64:
+  case PSCI_AFFINITY_INFO:
+  case PSCI_AFFINITY_INFO64:
+  case PSCI_MIGRATE_INFO_TYPE:
+  case PSCI_FEATURES:
+    return PSCI_RET_SUCCESS;
+  }
+  return PSCI_RET_NOT_SUPPORTED;
+}
+
+// Emulates PSCI 1.0 for the vCPUs of the current VM (function ID in x0,
+// arguments in x1-x3, result in x0).
+void handle_psci_call(void) {
+  struct pt_regs *regs = task_pt_regs(current);
+  unsigned long fn = regs->regs[0] & 0xffffffff;
+  unsigned long arg1 = regs->regs[1];
+  unsigned long arg2 = regs->regs[2];
+  unsigned long arg3 = regs->regs[3];
+  long ret;
+
+  if (!(fn & PSCI_0_2_64BIT)) {
+    arg1 &= 0xffffffff;
+    arg2 &= 0xffffffff;
+    arg3 &= 0xffffffff;
+  }
+
+  switch (fn) {
+  case PSCI_VERSION:
+    ret = 0x10000; // 1.0
+    break;
+  case PSCI_CPU_ON:
+  case PSCI_CPU_ON64:
+    ret = psci_cpu_on(arg1, arg2, arg3);
+    break;
+  case PSCI_CPU_OFF:
+    psci_cpu_off();
+    return;
+  case PSCI_AFFINITY_INFO:
+  case PSCI_AFFINITY_INFO64:
+    ret = psci_affinity_info(arg1, arg2);
+    break;
+  case PSCI_MIGRATE_INFO_TYPE:
+    ret = PSCI_TOS_NOT_PRESENT_MP;
+    break;
+  case PSCI_FEATURES:
+    ret = psci_features(arg1);
+    break;
+  default:
+    WARN("PSCI function %lx is not supported", fn);
+    ret = PSCI_RET_NOT_SUPPORTED;
+    break;
+  }
+  regs->regs[0] = ret;
+}
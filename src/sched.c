@@ -5,125 +5,829 @@
 #include "debug.h"
 #include "board.h"
 #include "task.h"
+#include "timer.h"
+#include "fpsimd.h"
+#include "pmu.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "exit_stat.h"
+#include "profile.h"
+#include "trace.h"
 
-static struct task_struct init_task = INIT_TASK;
-struct task_struct *current = &(init_task);
+// idle task of each CPU (runs on the boot stack of the CPU)
+static struct task_struct idle_tasks[NR_CPUS];
 struct task_struct *task[NR_TASKS] = {
-    &(init_task),
+    &(idle_tasks[0]),
 };
 int nr_tasks = 1;
 
-void _schedule(void) {
-  int next, c;
-  struct task_struct *p;
-  while (1) {
-    c = -1;
-    next = 0;
-    for (int i = 0; i < NR_TASKS; i++) {
-      p = task[i];
-      if (p && p->state == TASK_RUNNING && p->counter > c) {
-        c = p->counter;
-        next = i;
-      }
+// VM whose EL1 system registers are currently loaded on each CPU
+static struct task_struct *sysregs_loaded_task[NR_CPUS];
+
+// Credit scheduler. Every accounting period each VM with runnable vCPUs
+// gets credit in proportion to its weight, and the physical counter cycles
+// consumed by its vCPUs are charged against it. Runnable vCPUs are queued
+// by credit level (UNDER while the VM has credit left, OVER after that)
+// and run round-robin within a level for the timeslice of their VM.
+// A vCPU of an UNDER VM woken up by a virtual interrupt is BOOSTed for a
+// tick, and preempts the running vCPU if its VM consumed less than its
+// share in the period.
+// A VM with a cap is parked once it used cap% of a CPU in the period.
+struct prio_array {
+  unsigned int bitmap;
+  struct list_head queue[NR_PRIO];
+};
+
+// One runqueue per CPU. The running task stays on its runqueue.
+// A CPU whose runqueue became empty steals a task from the busiest one.
+// Runqueues are only touched with IRQs disabled.
+struct runqueue {
+  spinlock_t lock;
+  struct prio_array array;
+  struct list_head throttled; // parked by the cap of their VM
+  int nr_running;
+  int nr_throttled;
+  int need_resched; // a boosted task was queued (see check_preempt_wakeup())
+};
+
+static struct runqueue runqueues[NR_CPUS];
+
+#define this_rq() (&runqueues[smp_processor_id()])
+#define task_rq(p) (&runqueues[(p)->cpu])
+
+// tasks in TASK_BLOCKED state (linked by run_list)
+static spinlock_t blocked_lock;
+static struct list_head blocked_list = { &blocked_list, &blocked_list };
+
+#define is_idle_task(p) ((p) == &idle_tasks[(p)->cpu])
+
+// credit accounting is done by whichever CPU ticks first after a period
+static spinlock_t acct_lock;
+static unsigned long next_acct;
+
+static unsigned long acct_period_cycles(void) {
+  return us_to_cntpct(SCHED_ACCT_PERIOD);
+}
+
+// runtime allowed per accounting period by the cap
+static unsigned long cap_quota(struct vm_struct *vm) {
+  return acct_period_cycles() * vm->cap / 100;
+}
+
+static int vm_over_cap(struct vm_struct *vm) {
+  return vm->cap && vm->cap_used >= cap_quota(vm);
+}
+
+static long task_level(struct task_struct *p) {
+  struct vm_struct *vm = p->vm;
+  long credit = vm->credit - (long)vm->period_runtime;
+  return credit > 0 ? SCHED_PRIO_UNDER : SCHED_PRIO_OVER;
+}
+
+// charges the time since the task was switched in (or the last call)
+static void update_curr(struct task_struct *p) {
+  if (!p->vm)
+    return;
+  unsigned long now = get_cntpct();
+  unsigned long delta = now - p->exec_start;
+  p->exec_start = now;
+  p->sum_exec_runtime += delta;
+  // the vCPUs of a VM may run on several CPUs
+  __atomic_fetch_add(&p->vm->runtime, delta, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p->vm->period_runtime, delta, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p->vm->cap_used, delta, __ATOMIC_RELAXED);
+}
+
+static void account_wakeup_latency(struct task_struct *p) {
+  struct vm_struct *vm = p->vm;
+  unsigned long latency = p->exec_start - p->wakeup_start;
+  p->wakeup_start = 0;
+  __atomic_fetch_add(&vm->wakeup_count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&vm->wakeup_latency_total, latency, __ATOMIC_RELAXED);
+  if (latency > vm->wakeup_latency_max)
+    vm->wakeup_latency_max = latency;
+}
+
+void sched_init(void) {
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    struct runqueue *rq = &runqueues[cpu];
+    rq->array.bitmap = 0;
+    for (int j = 0; j < NR_PRIO; j++)
+      init_list_head(&rq->array.queue[j]);
+    init_list_head(&rq->throttled);
+    rq->nr_running = 0;
+    rq->nr_throttled = 0;
+
+    struct task_struct *idle = &idle_tasks[cpu];
+    idle->prio = SCHED_PRIO_OVER;
+    idle->cpu = cpu;
+    idle->on_cpu = 1;
+    idle->last_cpu = -1;
+    idle->sysregs_cpu = -1;
+    idle->fpsimd_cpu = -1;
+  }
+  init_idle_task(0);
+}
+
+// called on each CPU before it schedules for the first time
+void init_idle_task(int cpu) {
+  set_current(&idle_tasks[cpu]);
+}
+
+int set_vm_sched_params(struct vm_struct *vm, int weight, int cap,
+                        unsigned long timeslice) {
+  if (weight < SCHED_MIN_WEIGHT || weight > SCHED_MAX_WEIGHT ||
+      cap < 0 || cap > 100 * NR_CPUS || timeslice < SCHED_TICK)
+    return -1;
+  vm->weight = weight;
+  vm->cap = cap;
+  vm->timeslice = timeslice;
+  return 0;
+}
+
+static void enqueue_array(struct task_struct *p, struct prio_array *array) {
+  int idx = p->prio;
+  list_add_tail(&p->run_list, &array->queue[idx]);
+  array->bitmap |= 1U << idx;
+  p->array = array;
+}
+
+static void dequeue_array(struct task_struct *p) {
+  struct prio_array *array = p->array;
+  int idx = p->prio;
+  list_del(&p->run_list);
+  if (list_empty(&array->queue[idx]))
+    array->bitmap &= ~(1U << idx);
+  p->array = 0;
+}
+
+static struct task_struct *first_task(struct prio_array *array) {
+  int idx = 31 - __builtin_clz(array->bitmap);
+  return list_first_entry(&array->queue[idx], struct task_struct, run_list);
+}
+
+// the following are called with rq->lock held
+static void __enqueue_task(struct runqueue *rq, struct task_struct *p) {
+  if (vm_over_cap(p->vm)) {
+    list_add_tail(&p->run_list, &rq->throttled);
+    p->throttled = 1;
+    rq->nr_throttled++;
+    return;
+  }
+  p->prio = task_level(p);
+  if (p->boost && p->prio == SCHED_PRIO_UNDER) {
+    p->prio = SCHED_PRIO_BOOST;
+    rq->need_resched = 1;
+  }
+  p->boost = 0;
+  enqueue_array(p, &rq->array);
+  rq->nr_running++;
+}
+
+static void __dequeue_task(struct runqueue *rq, struct task_struct *p) {
+  p->boost = 0;
+  if (p->throttled) {
+    list_del(&p->run_list);
+    p->throttled = 0;
+    rq->nr_throttled--;
+    return;
+  }
+  dequeue_array(p);
+  rq->nr_running--;
+}
+
+static int on_rq(struct task_struct *p) {
+  return p->array || p->throttled;
+}
+
+// wakes up a CPU which has nothing to run so that it steals a task
+static void kick_idle_cpu(int busy_cpu) {
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    if (cpu != busy_cpu && cpu != smp_processor_id() &&
+        is_cpu_online(cpu) && runqueues[cpu].nr_running == 0) {
+      send_ipi(cpu);
+      return;
     }
-    if (c) {
-      break;
+  }
+}
+
+// The tick runs while there is another task to switch to, while a task
+// is parked by its cap, while a capped VM runs (to charge it), and while
+// profiling or a trace dump needs it.
+int need_sched_tick(void) {
+  struct runqueue *rq = this_rq();
+  spin_lock(&rq->lock);
+  int need = rq->nr_running > 1 || rq->nr_throttled > 0;
+  if (!need && rq->nr_running == 1)
+    need = first_task(&rq->array)->vm->cap > 0 || profile_enabled ||
+           trace_dump_pending();
+  spin_unlock(&rq->lock);
+  return need;
+}
+
+void enqueue_task(struct task_struct *p) {
+  if (is_idle_task(p))
+    return;
+  struct runqueue *rq = task_rq(p);
+  spin_lock(&rq->lock);
+  if (on_rq(p)) {
+    spin_unlock(&rq->lock);
+    return;
+  }
+  __enqueue_task(rq, p);
+  int nr_running = rq->nr_running;
+  spin_unlock(&rq->lock);
+
+  if (p->cpu == smp_processor_id())
+    update_sched_tick(need_sched_tick());
+  else
+    send_ipi(p->cpu);
+  if (nr_running > 1)
+    kick_idle_cpu(p->cpu);
+}
+
+void dequeue_task(struct task_struct *p) {
+  struct runqueue *rq = task_rq(p);
+  spin_lock(&rq->lock);
+  if (!on_rq(p)) {
+    spin_unlock(&rq->lock);
+    return;
+  }
+  __dequeue_task(rq, p);
+  spin_unlock(&rq->lock);
+
+  if (p->cpu == smp_processor_id())
+    update_sched_tick(need_sched_tick());
+}
+
+// places a new task on the online CPU with the fewest runnable tasks
+void wake_up_new_task(struct task_struct *p) {
+  int best = 0;
+  for (int cpu = 1; cpu < NR_CPUS; cpu++) {
+    if (is_cpu_online(cpu) &&
+        runqueues[cpu].nr_running < runqueues[best].nr_running)
+      best = cpu;
+  }
+  p->cpu = best;
+  enqueue_task(p);
+}
+
+int nr_running_tasks(void) {
+  return this_rq()->nr_running;
+}
+
+// moves the task to the tail of the queue of its current credit level
+static void expire_task(struct task_struct *p) {
+  struct runqueue *rq = task_rq(p);
+  spin_lock(&rq->lock);
+  if (p->array) {
+    dequeue_array(p);
+    p->prio = task_level(p);
+    enqueue_array(p, &rq->array);
+  }
+  spin_unlock(&rq->lock);
+}
+
+// parks the current task until its VM is under the cap again
+static void throttle_task(struct task_struct *p) {
+  struct runqueue *rq = task_rq(p);
+  spin_lock(&rq->lock);
+  if (p->array) {
+    __dequeue_task(rq, p);
+    __enqueue_task(rq, p);
+  }
+  spin_unlock(&rq->lock);
+}
+
+// whether a task of a higher credit level than p is waiting
+static int higher_level_waiting(struct task_struct *p) {
+  struct runqueue *rq = task_rq(p);
+  spin_lock(&rq->lock);
+  int ret = (rq->array.bitmap >> (task_level(p) + 1)) != 0;
+  spin_unlock(&rq->lock);
+  return ret;
+}
+
+// whether p consumed less than curr in this period, relative to the weights
+static int less_runtime(struct task_struct *p, struct task_struct *curr) {
+  return p->vm->period_runtime * curr->vm->weight <
+         curr->vm->period_runtime * p->vm->weight;
+}
+
+// Called at the end of IRQ handling. Runs a task boosted by a wakeup on
+// this runqueue (queued by this CPU or by another CPU, which sent an IPI),
+// or a task left at a higher credit level than current by the accounting.
+void check_preempt_wakeup(void) {
+  struct runqueue *rq = this_rq();
+  struct task_struct *curr = current;
+  if (!rq->need_resched)
+    return;
+
+  spin_lock(&rq->lock);
+  rq->need_resched = 0;
+  int preempt = 0;
+  // the idle task calls schedule() by itself after the interrupt
+  if (!is_idle_task(curr) && curr->prio != SCHED_PRIO_BOOST &&
+      rq->array.bitmap != 0) {
+    struct task_struct *p = first_task(&rq->array);
+    if (p->prio == SCHED_PRIO_BOOST)
+      preempt = p != curr && less_runtime(p, curr);
+    else
+      preempt = p->prio > curr->prio;
+  }
+  spin_unlock(&rq->lock);
+
+  if (preempt)
+    _schedule();
+}
+
+static int vm_is_active(struct vm_struct *vm) {
+  for (int i = 0; i < vm->nr_vcpus; i++) {
+    if (vm->vcpus[i]->state == TASK_RUNNING)
+      return 1;
+  }
+  return 0;
+}
+
+// unparks the tasks whose VM got under the cap
+static void unthrottle_tasks(void) {
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    struct runqueue *rq = &runqueues[cpu];
+    int woken = 0;
+    spin_lock(&rq->lock);
+    struct list_head *e = rq->throttled.next;
+    while (e != &rq->throttled) {
+      struct task_struct *p = container_of(e, struct task_struct, run_list);
+      e = e->next;
+      if (!vm_over_cap(p->vm)) {
+        __dequeue_task(rq, p);
+        __enqueue_task(rq, p);
+        woken++;
+      }
     }
-    for (int i = 0; i < NR_TASKS; i++) {
-      p = task[i];
-      if (p) {
-        p->counter = (p->counter >> 1) + p->priority;
+    spin_unlock(&rq->lock);
+
+    if (!woken)
+      continue;
+    if (cpu == smp_processor_id())
+      update_sched_tick(need_sched_tick());
+    else
+      send_ipi(cpu);
+  }
+}
+
+// Queued tasks keep the level they were queued at, so they are moved to
+// the level of the new credit of their VM. A CPU whose current task is
+// now below a queued one switches at the end of the IRQ (or its tick).
+static void update_queued_levels(void) {
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    struct runqueue *rq = &runqueues[cpu];
+    int changed = 0;
+    spin_lock(&rq->lock);
+    for (int idx = SCHED_PRIO_OVER; idx <= SCHED_PRIO_UNDER; idx++) {
+      struct list_head moved;
+      init_list_head(&moved);
+      struct list_head *head = &rq->array.queue[idx];
+      struct list_head *e = head->next;
+      while (e != head) {
+        struct task_struct *p = container_of(e, struct task_struct, run_list);
+        e = e->next;
+        if (task_level(p) != idx) {
+          dequeue_array(p);
+          list_add_tail(&p->run_list, &moved);
+        }
+      }
+      // enqueued after the walk so that no task is moved twice
+      while (!list_empty(&moved)) {
+        struct task_struct *p = list_first_entry(&moved, struct task_struct, run_list);
+        list_del(&p->run_list);
+        p->prio = task_level(p);
+        enqueue_array(p, &rq->array);
+        changed = 1;
       }
     }
+    if (changed)
+      rq->need_resched = 1;
+    spin_unlock(&rq->lock);
+
+    if (changed && cpu != smp_processor_id())
+      send_ipi(cpu);
+  }
+}
+
+// Distributes the credit of all online CPUs for one period among the
+// active VMs by weight, and charges the runtime consumed since the last
+// accounting.
+static void sched_account(void) {
+  unsigned long now = get_cntpct();
+  if (now < next_acct)
+    return;
+  spin_lock(&acct_lock);
+  if (now < next_acct) {
+    spin_unlock(&acct_lock);
+    return;
+  }
+  unsigned long period = acct_period_cycles();
+  next_acct = now + period;
+
+  int nr_cpus = 0;
+  for (int cpu = 0; cpu < NR_CPUS; cpu++)
+    nr_cpus += is_cpu_online(cpu);
+  long total = period * nr_cpus;
+
+  long total_weight = 0;
+  for (int i = 1; i < nr_vms; i++) {
+    if (vm_is_active(vms[i]))
+      total_weight += vms[i]->weight;
+  }
+
+  for (int i = 1; i < nr_vms; i++) {
+    struct vm_struct *vm = vms[i];
+    unsigned long used = __atomic_exchange_n(&vm->period_runtime, 0, __ATOMIC_RELAXED);
+    long credit = vm->credit - (long)used;
+    if (total_weight && vm_is_active(vm))
+      credit += total * vm->weight / total_weight;
+    // Credit is kept for up to two periods of the vCPUs: a VM that waited
+    // behind a full timeslice of another one would lose its share otherwise.
+    credit = MIN(credit, (long)(period * vm->nr_vcpus * 2));
+    vm->credit = MAX(credit, -total);
+
+    unsigned long cap_used = vm->cap_used;
+    unsigned long quota = vm->cap ? cap_quota(vm) : cap_used;
+    __atomic_fetch_sub(&vm->cap_used, MIN(cap_used, quota), __ATOMIC_RELAXED);
+  }
+  spin_unlock(&acct_lock);
+
+  update_queued_levels();
+  unthrottle_tasks();
+}
+
+static void double_lock(struct runqueue *a, struct runqueue *b) {
+  if (a < b) {
+    spin_lock(&a->lock);
+    spin_lock(&b->lock);
+  } else {
+    spin_lock(&b->lock);
+    spin_lock(&a->lock);
+  }
+}
+
+static void double_unlock(struct runqueue *a, struct runqueue *b) {
+  spin_unlock(&a->lock);
+  spin_unlock(&b->lock);
+}
+
+// A task can move to another CPU only when its registers are all saved.
+// EL1 registers of a VM are left loaded while its CPU is idle (see
+// switch_cpu_sysregs()), and such a VM is run again by the same CPU.
+static int can_migrate_task(struct task_struct *p) {
+  return !__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE) && p->sysregs_cpu < 0;
+}
+
+static struct task_struct *find_migratable_task(struct runqueue *rq) {
+  for (int idx = NR_PRIO - 1; idx >= 0; idx--) {
+    if (!(rq->array.bitmap & (1U << idx)))
+      continue;
+    struct list_head *head = &rq->array.queue[idx];
+    for (struct list_head *e = head->next; e != head; e = e->next) {
+      struct task_struct *p = container_of(e, struct task_struct, run_list);
+      if (can_migrate_task(p))
+        return p;
+    }
+  }
+  return 0;
+}
+
+// work stealing: called when the runqueue of this CPU is empty
+static void steal_task(int this_cpu) {
+  struct runqueue *rq = &runqueues[this_cpu];
+  struct runqueue *busiest = 0;
+  int max_running = 1;
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    if (cpu != this_cpu && runqueues[cpu].nr_running > max_running) {
+      busiest = &runqueues[cpu];
+      max_running = busiest->nr_running;
+    }
+  }
+  if (!busiest)
+    return;
+
+  double_lock(rq, busiest);
+  struct task_struct *p = 0;
+  if (rq->nr_running == 0 && busiest->nr_running > 1)
+    p = find_migratable_task(busiest);
+  if (p) {
+    __dequeue_task(busiest, p);
+    p->cpu = this_cpu;
+    __enqueue_task(rq, p);
+  }
+  double_unlock(rq, busiest);
+}
+
+static struct task_struct *pick_next_task(void) {
+  int cpu = smp_processor_id();
+  struct runqueue *rq = &runqueues[cpu];
+  if (rq->nr_running == 0)
+    steal_task(cpu);
+
+  spin_lock(&rq->lock);
+  struct task_struct *next = &idle_tasks[cpu];
+  if (rq->array.bitmap != 0) {
+    next = first_task(&rq->array);
+    next->slice_start = get_cntpct();
   }
-  //INFO("task switching to %d", next);
-  switch_to(task[next]);
+  next->on_cpu = 1;
+  spin_unlock(&rq->lock);
+  return next;
+}
+
+void _schedule(void) {
+  //INFO("task switching to %d", next->pid);
+  switch_to(pick_next_task());
 }
 
 void schedule(void) {
-  current->counter = 0;
+  expire_task(current);
   _schedule();
 }
 
+// BCM2837 routes the peripheral interrupts to core 0 only, so the
+// emulated interrupt controller only signals vCPU 0 of a VM.
+static const struct board_ops *irq_board_ops(struct task_struct *tsk) {
+  if (!tsk->vm || tsk->vcpu_id != 0)
+    return 0;
+  return tsk->vm->board_ops;
+}
+
+int has_pending_interrupt(struct task_struct *tsk) {
+  const struct board_ops *ops = irq_board_ops(tsk);
+  return (HAVE_FUNC(ops, is_irq_asserted) && ops->is_irq_asserted(tsk)) ||
+         (HAVE_FUNC(ops, is_fiq_asserted) && ops->is_fiq_asserted(tsk)) ||
+         pmu_irq_pending(tsk);
+}
+
+// Removes the current VM from the runqueue until wake_up_task() is called
+// (by UART input) or until wakeup_time (its next emulated timer event).
+// Interrupts raised by other CPUs are checked under blocked_lock, so that
+// a wakeup between the WFI trap and this call is not lost.
+void block_current_task(unsigned long wakeup_time) {
+  spin_lock(&blocked_lock);
+  if (has_pending_interrupt(current)) {
+    spin_unlock(&blocked_lock);
+    return;
+  }
+  current->state = TASK_BLOCKED;
+  current->wakeup_time = wakeup_time;
+  dequeue_task(current);
+  list_add_tail(&current->run_list, &blocked_list);
+  spin_unlock(&blocked_lock);
+
+  if (wakeup_time)
+    update_wakeup_timer();
+  _schedule();
+}
+
+// the task has a virtual interrupt to handle
+static void enqueue_woken_task(struct task_struct *p) {
+  p->wakeup_start = get_cntpct();
+  p->boost = 1;
+  enqueue_task(p);
+}
+
+void wake_up_task(struct task_struct *p) {
+  spin_lock(&blocked_lock);
+  if (p->state != TASK_BLOCKED) {
+    spin_unlock(&blocked_lock);
+    // a vCPU running on another CPU has to exit to get the virtual interrupt
+    if (p->on_cpu && p->cpu != smp_processor_id())
+      send_ipi(p->cpu);
+    return;
+  }
+  list_del(&p->run_list);
+  p->state = TASK_RUNNING;
+  p->wakeup_time = 0;
+  spin_unlock(&blocked_lock);
+
+  enqueue_woken_task(p);
+}
+
+void wake_up_expired_tasks(unsigned long now) {
+  struct list_head woken;
+  init_list_head(&woken);
+
+  spin_lock(&blocked_lock);
+  struct list_head *e = blocked_list.next;
+  while (e != &blocked_list) {
+    struct task_struct *p = container_of(e, struct task_struct, run_list);
+    e = e->next;
+    if (p->wakeup_time && p->wakeup_time <= now) {
+      list_del(&p->run_list);
+      p->state = TASK_RUNNING;
+      p->wakeup_time = 0;
+      list_add_tail(&p->run_list, &woken);
+    }
+  }
+  spin_unlock(&blocked_lock);
+
+  while (!list_empty(&woken)) {
+    struct task_struct *p = list_first_entry(&woken, struct task_struct, run_list);
+    list_del(&p->run_list);
+    enqueue_woken_task(p);
+  }
+}
+
+unsigned long earliest_wakeup_time(void) {
+  unsigned long earliest = 0;
+  spin_lock(&blocked_lock);
+  for (struct list_head *e = blocked_list.next; e != &blocked_list; e = e->next) {
+    struct task_struct *p = container_of(e, struct task_struct, run_list);
+    if (p->wakeup_time && (!earliest || p->wakeup_time < earliest))
+      earliest = p->wakeup_time;
+  }
+  spin_unlock(&blocked_lock);
+  return earliest;
+}
+
 void set_cpu_virtual_interrupt(struct task_struct *tsk) {
-  if (HAVE_FUNC(tsk->board_ops, is_irq_asserted) &&
-    tsk->board_ops->is_irq_asserted(tsk))
+  const struct board_ops *ops = irq_board_ops(tsk);
+  if ((HAVE_FUNC(ops, is_irq_asserted) && ops->is_irq_asserted(tsk)) ||
+      pmu_irq_pending(tsk))
     assert_virq();
   else
     clear_virq();
 
-  if (HAVE_FUNC(tsk->board_ops, is_fiq_asserted) &&
-    tsk->board_ops->is_fiq_asserted(tsk))
+  if (HAVE_FUNC(ops, is_fiq_asserted) && ops->is_fiq_asserted(tsk))
     assert_vfiq();
   else
     clear_vfiq();
 }
 
-void switch_to(struct task_struct *next) {
-  if (current == next)
+// EL1 registers are swapped only when a different VM is scheduled.
+// The idle task does not touch them, so they are left as is.
+static void switch_cpu_sysregs(struct task_struct *next) {
+  int cpu = smp_processor_id();
+  struct task_struct *loaded = sysregs_loaded_task[cpu];
+  if (!next->vm || loaded == next)
     return;
+  if (loaded) {
+    save_sysregs(&loaded->cpu_sysregs);
+    loaded->sysregs_cpu = -1;
+  }
+  set_cpu_sysregs(next);
+  next->sysregs_cpu = cpu;
+  sysregs_loaded_task[cpu] = next;
+
+  // The vCPUs of a VM share its VMID. Entries left from the last time
+  // this vCPU ran here, or from another vCPU, may be stale.
+  int *last_ran = &next->vm->last_vcpu_ran[cpu];
+  if (next->last_cpu != cpu || *last_ran != next->vcpu_id) {
+    flush_guest_tlb_local();
+    next->last_cpu = cpu;
+    *last_ran = next->vcpu_id;
+  }
+}
+
+// Forgets the EL1 registers of tsk loaded on this CPU without saving
+// them (used when its cpu_sysregs are reset by PSCI CPU_ON).
+void put_cpu_sysregs(struct task_struct *tsk) {
+  int cpu = smp_processor_id();
+  if (sysregs_loaded_task[cpu] == tsk)
+    sysregs_loaded_task[cpu] = 0;
+  tsk->sysregs_cpu = -1;
+}
+
+void switch_to(struct task_struct *next) {
   struct task_struct *prev = current;
-  current = next;
+  // also when prev == next: a vCPU reset by CPU_ON may keep running here
+  switch_cpu_sysregs(next);
+  if (prev == next)
+    return;
+
+  exit_stat_switch(prev);
+  update_curr(prev);
+  next->exec_start = get_cntpct();
+  if (next->wakeup_start)
+    account_wakeup_latency(next);
+  fpsimd_switch_to(prev, next);
+  pmu_switch_to(prev, next);
+  set_current(next);
+  prev = cpu_switch_to(prev, next);
+  schedule_tail(prev);
+}
 
-  cpu_switch_to(prev, next);
+// called by the next task after cpu_switch_to() (also from switch_from_kthread)
+void schedule_tail(struct task_struct *prev) {
+  // the registers of prev are saved, so other CPUs may run it now
+  __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
 }
 
 void timer_tick() {
-  --current->counter;
-  if (current->counter > 0) {
-    return;
+  // periodically lets idle CPUs look for a task to steal
+  if (this_rq()->nr_running > 1)
+    kick_idle_cpu(smp_processor_id());
+
+  sched_account();
+
+  if (!is_idle_task(current)) {
+    struct task_struct *p = current;
+    update_curr(p);
+    if (vm_over_cap(p->vm)) {
+      throttle_task(p);
+    } else if (p->prio == SCHED_PRIO_BOOST) {
+      // the boost lasts until the next tick
+      expire_task(p);
+    } else {
+      unsigned long slice = us_to_cntpct(p->vm->timeslice);
+      if (get_cntpct() - p->slice_start < slice && !higher_level_waiting(p))
+        return;
+      expire_task(p);
+    }
   }
-  current->counter = 0;
   _schedule();
 }
 
 void exit_task() {
-  for (int i = 0; i < NR_TASKS; i++) {
-    if (task[i] == current) {
-      task[i]->state = TASK_ZOMBIE;
-      break;
-    }
-  }
-  schedule();
+  current->state = TASK_ZOMBIE;
+  dequeue_task(current);
+  _schedule();
 }
 
 void set_cpu_sysregs(struct task_struct *tsk) {
-  set_stage2_pgd(tsk->mm.first_table, tsk->pid);
+  set_stage2_pgd(tsk->vm->mm.first_table, tsk->vm->id);
   restore_sysregs(&tsk->cpu_sysregs);
 }
 
+// also called around IRQs taken by the idle loop at EL2
 void vm_entering_work() {
-  if (HAVE_FUNC(current->board_ops, entering_vm))
-    current->board_ops->entering_vm(current);
+  struct vm_struct *vm = current->vm;
+  if (!vm)
+    return;
+  unsigned long begin = get_cntpct();
 
-  if (is_uart_forwarded_task(current))
-    flush_task_console(current);
+  if (current->vcpu_id == 0 && HAVE_FUNC(vm->board_ops, entering_vm)) {
+    spin_lock(&vm->lock);
+    vm->board_ops->entering_vm(current);
+    spin_unlock(&vm->lock);
+  }
+
+  if (is_uart_forwarded_vm(vm))
+    flush_vm_console(vm);
 
-  set_cpu_sysregs(current);
   set_cpu_virtual_interrupt(current);
+
+  exit_stat_entering(begin, get_cntpct());
 }
 
-void vm_leaving_work() {
-  save_sysregs(&current->cpu_sysregs);
+// entry_time: physical counter read in kernel_entry
+void vm_leaving_work(unsigned long entry_time) {
+  struct vm_struct *vm = current->vm;
+  if (!vm)
+    return;
+
+  if (current->vcpu_id == 0 && HAVE_FUNC(vm->board_ops, leaving_vm)) {
+    spin_lock(&vm->lock);
+    vm->board_ops->leaving_vm(current);
+    spin_unlock(&vm->lock);
+  }
 
-  if (HAVE_FUNC(current->board_ops, leaving_vm))
-    current->board_ops->leaving_vm(current);
+  if (is_uart_forwarded_vm(vm))
+    flush_vm_console(vm);
 
-  if (is_uart_forwarded_task(current))
-    flush_task_console(current);
+  exit_stat_leaving(entry_time, get_cntpct());
 }
 
 const char *task_state_str[] = {
   "RUNNING",
   "ZOMBIE",
+  "BLOCKED",
+  "STOPPED",
 };
 
 void show_task_list() {
-  printf("%3s %12s %8s %7s %8s %7s %7s %7s %7s %7s\n", "id", "name", "state", "pages", "saved-pc", "wfx", "hvc", "sysreg", "pf", "mmio");
+  printf("%3s %3s %4s %12s %8s %3s %7s %6s %8s %7s %7s %7s %7s %7s %7s %7s\n", "id", "vm", "vcpu", "name", "state", "cpu", "pages", "blocks", "saved-pc", "wfx", "hvc", "sysreg", "pf", "pf-avd", "mmio", "exit-ns");
   for (int i = 0; i < nr_tasks; i++) {
     struct task_struct *tsk = task[i];
-    printf("%3d %12s %8s %7d %8x %7d %7d %7d %7d %7d\n", tsk->pid, tsk->name ? tsk->name : "", task_state_str[tsk->state],
-        tsk->mm.user_pages_count, task_pt_regs(tsk)->pc, tsk->stat.wfx_trap_count, tsk->stat.hvc_trap_count,
-        tsk->stat.sysreg_trap_count, tsk->stat.pf_count, tsk->stat.mmio_count);
+    struct vm_struct *vm = tsk->vm;
+    unsigned long exit_ns = tsk->stat.exit_count ?
+      cntpct_to_ns(tsk->stat.exit_cycles / tsk->stat.exit_count) : 0;
+    printf("%3ld %3d %4d %12s %8s %3d %7d %6d %8lx %7ld %7ld %7ld %7ld %7ld %7ld %7lu\n", tsk->pid, vm ? vm->id : 0, tsk->vcpu_id,
+        vm ? vm->name : "IDLE", task_state_str[tsk->state], tsk->cpu,
+        vm ? vm->mm.user_pages_count : 0, vm ? vm->mm.block_mappings_count : 0, task_pt_regs(tsk)->pc, tsk->stat.wfx_trap_count, tsk->stat.hvc_trap_count,
+        tsk->stat.sysreg_trap_count, tsk->stat.pf_count, tsk->stat.pf_avoided_count, tsk->stat.mmio_count,
+        exit_ns);
+  }
+
+  printf("%3s %5s %6s %4s %8s %9s %10s %7s %7s %8s %7s %7s %7s\n", "vm", "vcpus", "weight", "cap", "slice-ms", "credit-ms", "runtime-ms", "wakeups", "wake-us", "wake-max", "poll-ok", "poll-ng", "poll-ms");
+  for (int i = 1; i < nr_vms; i++) {
+    struct vm_struct *vm = vms[i];
+    long credit = vm->credit - (long)vm->period_runtime;
+    unsigned long wake_us = vm->wakeup_count ?
+      cntpct_to_ns(vm->wakeup_latency_total / vm->wakeup_count) / 1000 : 0;
+    printf("%3d %5d %6d %4d %8lu %9ld %10lu %7lu %7lu %8lu %7lu %7lu %7lu\n", vm->id, vm->nr_vcpus, vm->weight, vm->cap,
+        vm->timeslice / 1000, credit < 0 ? -(long)cntpct_to_ms(-credit) : (long)cntpct_to_ms(credit),
+        cntpct_to_ms(vm->runtime), vm->wakeup_count, wake_us,
+        cntpct_to_ns(vm->wakeup_latency_max) / 1000, vm->halt_poll_success,
+        vm->halt_poll_fail, cntpct_to_ms(vm->halt_poll_cycles));
   }
+  show_free_area_info();
 }
@@ -0,0 +1,50 @@
+#include "smp.h"
+#include "peripherals/local.h"
+#include "sched.h"
+#include "timer.h"
+#include "utils.h"
+#include "debug.h"
+
+static volatile int cpu_online[NR_CPUS] = { 1 };
+
+void set_cpu_online(int cpu) {
+  cpu_online[cpu] = 1;
+}
+
+int is_cpu_online(int cpu) {
+  return cpu_online[cpu];
+}
+
+// All cores start at _start (kernel_old=1) and the secondary ones wait in
+// boot.S, with caches off, until their entry of spin_table becomes nonzero.
+void smp_boot_secondaries(void) {
+#ifdef CONFIG_NO_CACHE
+  // spinlocks need cacheable memory
+  INFO("caches are disabled, running on cpu0 only");
+#else
+  for (int cpu = 1; cpu < NR_CPUS; cpu++)
+    spin_table[cpu] = (unsigned long)secondary_startup;
+  flush_dcache_range(spin_table, sizeof(spin_table));
+  asm volatile("sev");
+
+  for (int cpu = 1; cpu < NR_CPUS; cpu++) {
+    unsigned long timeout = 1000000;
+    while (!cpu_online[cpu] && --timeout)
+      ;
+    if (!cpu_online[cpu])
+      WARN("cpu%d did not start", cpu);
+  }
+#endif
+}
+
+void send_ipi(int cpu) {
+  if (cpu_online[cpu])
+    put32(CORE_MBOX0_SET(cpu), 1);
+}
+
+// sent when a task is enqueued to the runqueue of another CPU, or to make
+// the VM running there exit so that its virtual interrupts are updated
+void handle_ipi(void) {
+  put32(CORE_MBOX0_RDCLR(smp_processor_id()), 0xffffffff);
+  update_sched_tick(need_sched_tick());
+}
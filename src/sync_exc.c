@@ -4,6 +4,14 @@
 #include "sched.h"
 #include "debug.h"
 #include "task.h"
+#include "board.h"
+#include "fpsimd.h"
+#include "psci.h"
+#include "pmu.h"
+#include "timer.h"
+#include "utils.h"
+#include "exit_stat.h"
+#include "exit_site.h"
 #include "arm/sysregs.h"
 
 const char *sync_error_reasons[] = {
@@ -70,9 +78,88 @@ const char *sync_error_reasons[] = {
   "BRK instruction execution in AArch64 state.",
 };
 
-void handle_trap_wfx() {
-  schedule();
+#define ESR_ISS_WFX_TI_WFE 0x1
+
+// Adaptive halt polling: before blocking on WFI, the vCPU spins for a
+// short window in case an interrupt comes soon, which saves the switch to
+// another task and back. The window grows when polling succeeds and
+// shrinks when it fails.
+#define HALT_POLL_START 10  // us
+#define HALT_POLL_MAX   200 // us
+
+static void grow_halt_poll_window(struct task_struct *p) {
+  unsigned long max = us_to_cntpct(HALT_POLL_MAX);
+  if (p->halt_poll_window == 0)
+    p->halt_poll_window = us_to_cntpct(HALT_POLL_START);
+  else
+    p->halt_poll_window = MIN(p->halt_poll_window * 2, max);
+}
+
+static void shrink_halt_poll_window(struct task_struct *p) {
+  p->halt_poll_window /= 2;
+  if (p->halt_poll_window < us_to_cntpct(HALT_POLL_START))
+    p->halt_poll_window = 0;
+}
+
+// Returns 1 if the vCPU should go back to the guest instead of blocking.
+// The emulated systimer is only updated when entering the VM, so its next
+// event is checked here directly. A pending physical IRQ (e.g. UART input)
+// also ends polling, and is handled after returning to the guest.
+static int halt_poll(unsigned long wakeup_time) {
+  struct task_struct *p = current;
+  struct vm_struct *vm = p->vm;
+  // nothing to gain if another task can use the CPU
+  if (nr_running_tasks() > 1) {
+    p->halt_poll_window = 0;
+    return 0;
+  }
+  if (p->halt_poll_window == 0) {
+    // a window shrunk to 0 is tried again from the start on the next WFI
+    grow_halt_poll_window(p);
+    return 0;
+  }
+
+  unsigned long start = get_cntpct();
+  unsigned long now = start;
+  int woken = 0;
+  while (now - start < p->halt_poll_window) {
+    if (has_pending_interrupt(p) || (get_isr() & (ISR_I | ISR_F)) ||
+        (wakeup_time && get_physical_timer_count() >= wakeup_time)) {
+      woken = 1;
+      break;
+    }
+    if (nr_running_tasks() > 1)
+      break;
+    now = get_cntpct();
+  }
+  vm->halt_poll_cycles += now - start;
+
+  if (woken) {
+    vm->halt_poll_success++;
+    grow_halt_poll_window(p);
+  } else {
+    vm->halt_poll_fail++;
+    shrink_halt_poll_window(p);
+  }
+  return woken;
+}
+
+void handle_trap_wfx(unsigned long esr) {
   increment_current_pc(4);
+  // interrupts are only delivered to vCPU 0 (see irq_board_ops()),
+  // so the other vCPUs just yield
+  if ((esr & ESR_ISS_WFX_TI_WFE) || current->vcpu_id != 0) {
+    schedule();
+  } else if (!has_pending_interrupt(current)) {
+    // WFI: sleep until a virtual interrupt can be raised
+    const struct board_ops *ops = current->vm->board_ops;
+    unsigned long wakeup_time = 0;
+    if (HAVE_FUNC(ops, next_timer_event))
+      wakeup_time = ops->next_timer_event(current);
+    if (halt_poll(wakeup_time))
+      return;
+    block_current_task(wakeup_time);
+  }
 }
 
 void handle_hvc64(unsigned long hvc_nr) {
@@ -94,6 +181,11 @@ void handle_trap_system(unsigned long esr) {
   } \
 } while(0)
 
+  if (is_pmu_sysreg(esr)) {
+    handle_trap_pmu(esr);
+    return;
+  }
+
   struct pt_regs *regs = task_pt_regs(current);
 
   unsigned int op0 = (esr >> 20) & 0x3;
@@ -157,6 +249,7 @@ sys_fin:
 #define ESR_EL2_EC_TRAP_WFX       1
 #define ESR_EL2_EC_TRAP_FP_REG    7
 #define ESR_EL2_EC_HVC64          22
+#define ESR_EL2_EC_SMC64          23
 #define ESR_EL2_EC_TRAP_SYSTEM    24
 #define ESR_EL2_EC_TRAP_SVE       25
 #define ESR_EL2_EC_DABT_LOW       36
@@ -164,18 +257,34 @@ sys_fin:
 void handle_sync_exception(unsigned long esr, unsigned long elr,
     unsigned long far, unsigned long hvc_nr) {
   int eclass = (esr >> ESR_EL2_EC_SHIFT) & 0x3f;
+  exit_stat_set_sync(esr, far);
+  // aborts are recorded with the IPA by handle_mem_abort()
+  if (eclass != ESR_EL2_EC_DABT_LOW)
+    exit_site_record(elr, eclass, 0);
 
   switch (eclass) {
   case ESR_EL2_EC_TRAP_WFX:
     current->stat.wfx_trap_count++;
-    handle_trap_wfx();
+    handle_trap_wfx(esr);
     break;
   case ESR_EL2_EC_TRAP_FP_REG:
-    WARN("TRAP_FP_REG is not implemented.");
+    handle_trap_fpsimd();
     break;
   case ESR_EL2_EC_HVC64:
     current->stat.hvc_trap_count++;
-    handle_hvc64(hvc_nr);
+    if (is_psci_call(task_pt_regs(current)->regs[0]))
+      handle_psci_call();
+    else
+      handle_hvc64(hvc_nr);
+    break;
+  case ESR_EL2_EC_SMC64:
+    // unlike HVC, ELR points to the trapped SMC itself
+    increment_current_pc(4);
+    current->stat.hvc_trap_count++;
+    if (is_psci_call(task_pt_regs(current)->regs[0]))
+      handle_psci_call();
+    else
+      task_pt_regs(current)->regs[0] = PSCI_RET_NOT_SUPPORTED;
     break;
   case ESR_EL2_EC_TRAP_SYSTEM:
     current->stat.sysreg_trap_count++;
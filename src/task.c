@@ -7,6 +7,13 @@
 #include "bcm2837.h"
 #include "board.h"
 #include "fifo.h"
+#include "spinlock.h"
+#include "exit_stat.h"
+#include "pmu.h"
+#include "boot_prof.h"
+
+// sd.c and fat32.c are not reentrant
+static spinlock_t loader_lock;
 
 struct pt_regs *task_pt_regs(struct task_struct *tsk) {
   unsigned long p = (unsigned long)tsk + THREAD_SIZE - sizeof(struct pt_regs);
@@ -20,13 +27,25 @@ static void prepare_task(loader_func_t loader, void *arg) {
   regs->pstate = PSR_MODE_EL1h;
   regs->pstate |= (0xf << 6); // interrupt mask
 
-  if (loader(arg, &regs->pc, &regs->sp) < 0) {
+  spin_lock(&loader_lock);
+  int phase = boot_phase_begin("load", current->vm->id);
+  int ret = loader(arg, &regs->pc, &regs->sp);
+  boot_phase_end(phase, 0);
+  spin_unlock(&loader_lock);
+  if (ret < 0) {
     PANIC("failed to load");
   }
 
+  phase = boot_phase_begin("stage-2 prefault", current->vm->id);
+  current->stat.pf_avoided_count += prefault_stage2(current->vm);
+  boot_phase_end(phase, 0);
+  invalidate_icache();
+
   set_cpu_sysregs(current);
 
   INFO("loaded");
+  // kernel_exit enters the guest right after
+  boot_prof_guest_started(current->vm->id);
 }
 
 static struct cpu_sysregs initial_sysregs;
@@ -48,56 +67,162 @@ void increment_current_pc(int ilen) {
   regs->pc += ilen;
 }
 
-int create_task(loader_func_t loader, void *arg) {
+struct vm_struct *vms[NR_VMS];
+int nr_vms = 1; // VMID 0 is not used
+
+// secondary vCPUs start here once they are powered on by PSCI CPU_ON
+static void start_secondary_vcpu(void) {
+  INFO("vCPU %d of VM %d started", current->vcpu_id, current->vm->id);
+}
+
+void reset_vcpu_sysregs(struct task_struct *p) {
+  memcpy(&p->cpu_sysregs, &initial_sysregs,
+         sizeof(struct cpu_sysregs));
+  p->cpu_sysregs.mpidr_el1 = (initial_sysregs.mpidr_el1 & ~0xffUL) | p->vcpu_id;
+  if (p->pmu)
+    memzero(p->pmu, sizeof(struct pmu_state));
+}
+
+static void free_vcpu(struct task_struct *p) {
+  if (p->exit_stats)
+    free_pages(TO_PADDR(p->exit_stats));
+  if (p->fpsimd)
+    deallocate_page(p->fpsimd);
+  deallocate_page(p);
+}
+
+// frees a VM whose vCPUs never ran
+static void free_vm(struct vm_struct *vm) {
+  for (int i = 0; i < NR_VCPUS; i++) {
+    if (vm->vcpus[i])
+      free_vcpu(vm->vcpus[i]);
+  }
+  if (vm->board_data)
+    deallocate_page(vm->board_data);
+  free_stage2_tables(vm);
+  if (vm->console.in_fifo)
+    deallocate_page(vm->console.in_fifo);
+  if (vm->console.out_fifo)
+    deallocate_page(vm->console.out_fifo);
+  deallocate_page(vm);
+}
+
+// The vCPU gets its pid in create_vm() once nothing can fail anymore.
+static struct task_struct *create_vcpu(struct vm_struct *vm, int vcpu_id) {
   struct task_struct *p;
 
   p = (struct task_struct *)allocate_page();
-  struct pt_regs *childregs = task_pt_regs(p);
-
   if (!p)
-    return -1;
+    return 0;
+  struct pt_regs *childregs = task_pt_regs(p);
 
-  p->cpu_context.x19 = (unsigned long)prepare_task;
-  p->cpu_context.x20 = (unsigned long)loader;
-  p->cpu_context.x21 = (unsigned long)arg;
-  p->flags = 0;
-  p->priority = current->priority;
-  p->state = TASK_RUNNING;
-  p->counter = p->priority;
-  p->name = "VM";
+  p->fpsimd = (struct fpsimd_state *)allocate_page();
+  if (!p->fpsimd)
+    goto fail;
 
-  p->board_ops = &bcm2837_board_ops;
-  if (HAVE_FUNC(p->board_ops, initialize))
-    p->board_ops->initialize(p);
+  p->exit_stats = allocate_exit_stats();
+  if (!p->exit_stats)
+    goto fail;
 
-  prepare_initial_sysregs();
-  memcpy(&p->cpu_sysregs, &initial_sysregs,
-         sizeof(struct cpu_sysregs));
+  p->flags = 0;
+  p->vm = vm;
+  p->vcpu_id = vcpu_id;
+  p->last_cpu = -1;
+  p->sysregs_cpu = -1;
+  p->fpsimd_cpu = -1;
+  reset_vcpu_sysregs(p);
 
   p->cpu_context.pc = (unsigned long)switch_from_kthread;
   p->cpu_context.sp = (unsigned long)childregs;
-  int pid = nr_tasks++;
-  task[pid] = p;
-  p->pid = pid;
 
-  init_task_console(p);
+  vm->vcpus[vcpu_id] = p;
+  return p;
 
-  return pid;
+fail:
+  free_vcpu(p);
+  return 0;
 }
 
-void init_task_console(struct task_struct *tsk) {
-  tsk->console.in_fifo = create_fifo();
-  tsk->console.out_fifo = create_fifo();
+// Creates a VM with params->nr_vcpus vCPUs. vCPU 0 runs the loader and
+// then the guest, the others stay in TASK_STOPPED until the guest calls
+// CPU_ON.
+int create_vm(loader_func_t loader, void *arg,
+              const struct vm_params *params) {
+  struct vm_struct *vm;
+  int nr_vcpus = params->nr_vcpus;
+
+  if (nr_vms >= NR_VMS || nr_vcpus < 1 || nr_vcpus > NR_VCPUS ||
+      nr_tasks + nr_vcpus > NR_TASKS)
+    return -1;
+
+  vm = (struct vm_struct *)allocate_page();
+  if (!vm)
+    return -1;
+  if (set_vm_sched_params(vm, params->weight, params->cap,
+                          params->timeslice) < 0)
+    goto fail;
+
+  vm->name = "VM";
+  vm->nr_vcpus = nr_vcpus;
+  for (int cpu = 0; cpu < NR_CPUS; cpu++)
+    vm->last_vcpu_ran[cpu] = -1;
+  set_stage2_block_policy(vm, STAGE2_BLOCK_ON_THRESHOLD,
+                          STAGE2_BLOCK_DEFAULT_THRESHOLD);
+  set_stage2_fault_around(vm, FAULT_AROUND_DEFAULT_PAGES);
+  set_stage2_prefault(vm, params->prefault_size);
+  vm->console.in_fifo = create_fifo();
+  vm->console.out_fifo = create_fifo();
+  if (!vm->console.in_fifo || !vm->console.out_fifo)
+    goto fail;
+
+  prepare_initial_sysregs();
+
+  for (int i = 0; i < nr_vcpus; i++) {
+    struct task_struct *p = create_vcpu(vm, i);
+    if (!p)
+      goto fail;
+    if (i == 0) {
+      p->cpu_context.x19 = (unsigned long)prepare_task;
+      p->cpu_context.x20 = (unsigned long)loader;
+      p->cpu_context.x21 = (unsigned long)arg;
+      p->state = TASK_RUNNING;
+    } else {
+      p->cpu_context.x19 = (unsigned long)start_secondary_vcpu;
+      p->state = TASK_STOPPED;
+    }
+  }
+
+  for (int i = 0; i < nr_vcpus; i++) {
+    int pid = nr_tasks++;
+    task[pid] = vm->vcpus[i];
+    vm->vcpus[i]->pid = pid;
+  }
+
+  // VMs are only created by hypervisor_main(), the id is known beforehand
+  int id = nr_vms;
+  vm->id = id;
+
+  vm->board_ops = &bcm2837_board_ops;
+  if (HAVE_FUNC(vm->board_ops, initialize))
+    vm->board_ops->initialize(vm->vcpus[0]);
+
+  // the scheduler of other CPUs walks vms[0..nr_vms)
+  vms[id] = vm;
+  __atomic_store_n(&nr_vms, id + 1, __ATOMIC_RELEASE);
+
+  wake_up_new_task(vm->vcpus[0]);
+
+  return id;
+
+fail:
+  free_vm(vm);
+  return -1;
 }
 
-void flush_task_console(struct task_struct *tsk) {
-  struct fifo *outfifo = tsk->console.out_fifo;
+void flush_vm_console(struct vm_struct *vm) {
+  struct fifo *outfifo = vm->console.out_fifo;
   unsigned long val;
   while(dequeue_fifo(outfifo, &val) == 0) {
     printf("%c", val & 0xff);
   }
 }
-
-void init_initial_task() {
-  task[0]->name = "IDLE";
-}
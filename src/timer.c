@@ -1,25 +1,119 @@
 #include "peripherals/timer.h"
+#include "timer.h"
 #include "sched.h"
 #include "utils.h"
 #include "debug.h"
 #include "board.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "profile.h"
+#include "trace.h"
 
-const unsigned int interval = 400000;
+
+// compare values closer than this may be missed
+#define TIMER_MIN_DELTA 10
+
+// The scheduler tick uses the EL2 physical timer of each CPU, since the
+// system timer interrupts are routed to CPU0 only. It runs only while
+// is something for the scheduler to do on the CPU (see need_sched_tick()).
+static unsigned long tick_cycles;
+static int tick_enabled[NR_CPUS];
+
+// C3 is shared by the VMs running on all CPUs and the VMs blocked in WFI
+static spinlock_t timer3_lock;
+static unsigned long vm_timer_deadline[NR_CPUS];
+static unsigned long timer3_deadline; // programmed in C3, 0: none or firing
 
 void timer_init(void) {
-  put32(TIMER_C1, get32(TIMER_CLO) + interval);
+  tick_cycles = us_to_cntpct(SCHED_TICK);
+}
+
+void update_sched_tick(int needed) {
+  int cpu = smp_processor_id();
+  if (needed && !tick_enabled[cpu]) {
+    tick_enabled[cpu] = 1;
+    set_hyp_timer(tick_cycles);
+  } else if (!needed && tick_enabled[cpu]) {
+    tick_enabled[cpu] = 0;
+    stop_hyp_timer();
+  }
 }
 
 // for task switch
-void handle_timer1_irq(void) {
-  put32(TIMER_C1, get32(TIMER_CLO) + interval);
-  put32(TIMER_CS, TIMER_CS_M1);
+void handle_sched_timer_irq(void) {
+  int cpu = smp_processor_id();
+  // the tick is stopped lazily when tasks are stolen by other CPUs
+  if (!need_sched_tick()) {
+    tick_enabled[cpu] = 0;
+    stop_hyp_timer();
+    return;
+  }
+  tick_enabled[cpu] = 1;
+  set_hyp_timer(tick_cycles);
+  profile_tick();
+  trace_dump_tick();
   timer_tick();
 }
 
-// for vm's interrupt
+// called with timer3_lock held
+static void program_timer3(void) {
+  unsigned long deadline = earliest_wakeup_time();
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    unsigned long d = vm_timer_deadline[cpu];
+    if (d && (!deadline || d < deadline))
+      deadline = d;
+  }
+  if (!deadline)
+    return;
+  unsigned long now = get_physical_timer_count();
+  if (deadline < now + TIMER_MIN_DELTA)
+    deadline = now + TIMER_MIN_DELTA;
+  put32(TIMER_C3, deadline & 0xffffffff);
+  __atomic_store_n(&timer3_deadline, deadline, __ATOMIC_SEQ_CST);
+}
+
+// Deadline of the VM running on this CPU, called on every VM entry. C3 is
+// only reprogrammed when the deadline comes before the programmed one:
+// otherwise handle_timer3_irq() sees it when C3 fires, since it clears
+// timer3_deadline before reading the deadlines.
+void set_vm_timer(unsigned long deadline) {
+  int cpu = smp_processor_id();
+  if (__atomic_load_n(&vm_timer_deadline[cpu], __ATOMIC_RELAXED) == deadline)
+    return;
+  __atomic_store_n(&vm_timer_deadline[cpu], deadline, __ATOMIC_SEQ_CST);
+  unsigned long programmed = __atomic_load_n(&timer3_deadline, __ATOMIC_SEQ_CST);
+  if (!deadline || (programmed && programmed <= deadline))
+    return;
+  spin_lock(&timer3_lock);
+  program_timer3();
+  spin_unlock(&timer3_lock);
+}
+
+void update_wakeup_timer(void) {
+  spin_lock(&timer3_lock);
+  program_timer3();
+  spin_unlock(&timer3_lock);
+}
+
+// for vm's interrupt (CPU0 only)
 void handle_timer3_irq(void) {
   put32(TIMER_CS, TIMER_CS_M3);
+  unsigned long now = get_physical_timer_count();
+  wake_up_expired_tasks(now);
+
+  spin_lock(&timer3_lock);
+  __atomic_store_n(&timer3_deadline, 0, __ATOMIC_SEQ_CST);
+  // VMs on other CPUs have to exit to get the virtual interrupt. Their
+  // deadlines are updated without the lock (see set_vm_timer()).
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    unsigned long d = __atomic_load_n(&vm_timer_deadline[cpu], __ATOMIC_SEQ_CST);
+    if (cpu != smp_processor_id() && d && d <= now &&
+        __atomic_compare_exchange_n(&vm_timer_deadline[cpu], &d, 0, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      send_ipi(cpu);
+  }
+  program_timer3();
+  spin_unlock(&timer3_lock);
 }
 
 unsigned long get_physical_timer_count() {
@@ -28,6 +122,18 @@ unsigned long get_physical_timer_count() {
   return clo | (chi << 32);
 }
 
+unsigned long cntpct_to_ns(unsigned long count) {
+  return count * 1000000000 / get_cntfrq();
+}
+
+unsigned long cntpct_to_ms(unsigned long count) {
+  return count / (get_cntfrq() / 1000);
+}
+
+unsigned long us_to_cntpct(unsigned long us) {
+  return get_cntfrq() * us / 1000000;
+}
+
 void show_systimer_info() {
   printf("HI: %x\nLO: %x\nCS:%x\nC1: %x\nC3: %x\n",
       get32(TIMER_CHI), get32(TIMER_CLO),
@@ -0,0 +1,195 @@
+#include "trace.h"
+#include "mm.h"
+#include "smp.h"
+#include "timer.h"
+#include "sched.h"
+#include "utils.h"
+#include "printf.h"
+#include "mini_uart.h"
+
+// Each CPU only writes its own buffer, and the oldest entries are
+// overwritten when it is full. Recording costs a flag check when off.
+struct trace_buffer {
+  unsigned long head;  // number of entries ever written
+  unsigned long drained; // entries before this were already dumped
+  unsigned long lost;  // overwritten before being dumped
+  volatile int writing; // in trace_exit(), see stop_trace_writers()
+  struct trace_entry *entries;
+};
+
+_Static_assert(sizeof(struct trace_entry) * TRACE_ENTRIES <= (PAGE_SIZE << TRACE_ORDER),
+               "trace buffer does not fit in TRACE_ORDER");
+
+#define DUMP_NONE      0
+#define DUMP_REQUESTED 1
+#define DUMP_RUNNING   2
+
+volatile int trace_enabled;
+static struct trace_buffer trace_buffers[NR_CPUS];
+static volatile int dump_state = DUMP_NONE;
+static int dump_resume_trace; // trace_enabled when the dump was requested
+static int dump_started;          // the header was sent
+static int dump_cpu;              // CPU whose entries are being sent
+static unsigned long dump_next, dump_head; // entries of dump_cpu left
+
+// buffers are allocated the first time tracing is enabled
+int enable_trace(void) {
+  // the buffers must not change until the dump is written
+  if (dump_state != DUMP_NONE)
+    return -1;
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    struct trace_buffer *buf = &trace_buffers[cpu];
+    if (buf->entries)
+      continue;
+    buf->entries = (struct trace_entry *)allocate_pages(TRACE_ORDER);
+    if (!buf->entries)
+      return -1;
+  }
+  __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void disable_trace(void) {
+  trace_enabled = 0;
+  dump_resume_trace = 0;
+}
+
+void trace_exit(struct trace_entry *e) {
+  int cpu = smp_processor_id();
+  struct trace_buffer *buf = &trace_buffers[cpu];
+  // either the dumping CPU waits for this entry, or it is not written
+  __atomic_store_n(&buf->writing, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&trace_enabled, __ATOMIC_SEQ_CST)) {
+    e->cpu = cpu;
+    buf->entries[buf->head % TRACE_ENTRIES] = *e;
+    // the dumping CPU reads entries up to head
+    __atomic_store_n(&buf->head, buf->head + 1, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&buf->writing, 0, __ATOMIC_RELEASE);
+}
+
+// After this, no CPU writes to its buffer until trace_enabled is set again.
+static void stop_trace_writers(void) {
+  __atomic_store_n(&trace_enabled, 0, __ATOMIC_SEQ_CST);
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    while (__atomic_load_n(&trace_buffers[cpu].writing, __ATOMIC_ACQUIRE))
+      ;
+  }
+}
+
+static void send_bytes(const void *p, unsigned long size) {
+  const char *c = p;
+  for (unsigned long i = 0; i < size; i++)
+    uart_send_raw(c[i]);
+}
+
+static void send_u32(uint32_t v) {
+  send_bytes(&v, sizeof(v));
+}
+
+// Recording is paused from the request, so that the dump shows the exits
+// until then. The dump is written by run_trace_dump() and trace_dump_tick().
+void dump_trace(void) {
+  int state = DUMP_NONE;
+  // DUMP_RUNNING keeps the other CPUs away until the writers are stopped
+  if (!__atomic_compare_exchange_n(&dump_state, &state, DUMP_RUNNING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  dump_resume_trace = trace_enabled;
+  stop_trace_writers();
+  dump_started = 0;
+  __atomic_store_n(&dump_state, DUMP_REQUESTED, __ATOMIC_RELEASE);
+
+  // start the ticks of the CPUs running a single task
+  for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+    if (cpu == smp_processor_id())
+      update_sched_tick(need_sched_tick());
+    else
+      send_ipi(cpu);
+  }
+}
+
+int trace_dump_pending(void) {
+  return dump_state != DUMP_NONE;
+}
+
+// the entries of cpu recorded since the last dump are sent next
+static void begin_cpu_dump(int cpu) {
+  struct trace_buffer *buf = &trace_buffers[cpu];
+  unsigned long head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+  unsigned long begin = buf->drained;
+  if (head - begin > TRACE_ENTRIES) {
+    buf->lost += head - TRACE_ENTRIES - begin;
+    begin = head - TRACE_ENTRIES;
+  }
+  dump_cpu = cpu;
+  dump_next = begin;
+  dump_head = head;
+}
+
+// Writes the entries recorded since the last dump as a binary stream:
+//   "RVTR" u16 version, u16 entry size, u32 counter frequency, u32 CPUs
+//   per CPU, one or more chunks:
+//     "RVTC" u32 cpu, u32 count, u32 lost, count * struct trace_entry
+//   "RVTE"
+// Each call sends one chunk of at most max entries with the console
+// locked, so the output of other CPUs may come between the chunks.
+// Returns 0 when there is nothing left, or another CPU is sending.
+static int send_dump_chunk(int max) {
+  int state = DUMP_REQUESTED;
+  if (!__atomic_compare_exchange_n(&dump_state, &state, DUMP_RUNNING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+
+  unsigned long flags = lock_stdout();
+  if (!dump_started) {
+    uint16_t header[2] = { TRACE_VERSION, sizeof(struct trace_entry) };
+    send_bytes(TRACE_MAGIC, 4);
+    send_bytes(header, sizeof(header));
+    send_u32(get_cntfrq());
+    send_u32(NR_CPUS);
+    dump_started = 1;
+    begin_cpu_dump(0);
+  }
+
+  // an empty chunk tells the lost count of an idle CPU
+  struct trace_buffer *buf = &trace_buffers[dump_cpu];
+  unsigned long end = MIN(dump_head, dump_next + max);
+  send_bytes(TRACE_CHUNK_MAGIC, 4);
+  send_u32(dump_cpu);
+  send_u32(end - dump_next);
+  send_u32(buf->lost);
+  for (unsigned long i = dump_next; i < end; i++)
+    send_bytes(&buf->entries[i % TRACE_ENTRIES], sizeof(struct trace_entry));
+  dump_next = end;
+
+  if (dump_next == dump_head) {
+    buf->drained = dump_head;
+    if (dump_cpu + 1 < NR_CPUS) {
+      begin_cpu_dump(dump_cpu + 1);
+    } else {
+      send_bytes(TRACE_END_MAGIC, 4);
+      unlock_stdout(flags);
+      trace_enabled = dump_resume_trace;
+      __atomic_store_n(&dump_state, DUMP_NONE, __ATOMIC_RELEASE);
+      return 0;
+    }
+  }
+  unlock_stdout(flags);
+  __atomic_store_n(&dump_state, DUMP_REQUESTED, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// called by the idle loop with IRQs enabled, which stay enabled between
+// the chunks (about 70 ms each at 115200 baud)
+void run_trace_dump(void) {
+  while (send_dump_chunk(TRACE_DUMP_CHUNK))
+    ;
+}
+
+// called on the scheduler tick, which keeps running while a dump is
+// pending (see need_sched_tick()), so that CPUs busy with VMs drain it too
+void trace_dump_tick(void) {
+  if (dump_state == DUMP_REQUESTED)
+    send_dump_chunk(TRACE_TICK_CHUNK);
+}
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Decode the VM exit trace dumped by raspvisor (? + d on the console).
+
+Capture the UART output to a file (e.g. with `picocom --logfile`), then:
+
+    tools/decode_trace.py uart.log            # timeline and summary
+    tools/decode_trace.py --summary uart.log  # summary only
+    tools/decode_trace.py --mmio uart.log     # MMIO trace for tools/host/mmioreplay
+
+Every dump found in the file is decoded. See include/trace.h for the format.
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+MAGIC = b"RVTR"
+CHUNK_MAGIC = b"RVTC"
+END_MAGIC = b"RVTE"
+HEADER = struct.Struct("<4sHHII")
+CPU_HEADER = struct.Struct("<III")
+# entries by version, the value of emulated MMIO was added in version 2,
+# version 3 sends the entries of a CPU in chunks (see src/trace.c)
+ENTRIES = {
+    1: struct.Struct("<QQQIIHBBBbH"),
+    2: struct.Struct("<QQQIIHBBBbHQ"),
+    3: struct.Struct("<QQQIIHBBBbHQ"),
+}
+
+EXIT_REASON_IRQ = 64
+REASONS = {
+    0x01: "WFx",
+    0x07: "FP",
+    0x16: "HVC64",
+    0x17: "SMC64",
+    0x18: "SYSREG",
+    0x20: "IABT",
+    0x24: "DABT",
+    EXIT_REASON_IRQ: "IRQ",
+}
+RESULTS = {0: "resumed", 1: "switched"}
+
+
+def reason_name(reason):
+    return REASONS.get(reason, "ec%02x" % reason)
+
+
+def parse_dumps(data):
+    """Yields (cntfrq, lost per CPU, entries) for each dump in data."""
+    pos = 0
+    while True:
+        pos = data.find(MAGIC, pos)
+        if pos < 0:
+            return
+        try:
+            _, version, entry_size, cntfrq, nr_cpus = HEADER.unpack_from(data, pos)
+            entry = ENTRIES.get(version)
+            if entry is None or entry_size != entry.size:
+                raise ValueError("unsupported version %d" % version)
+            off = pos + HEADER.size
+            lost = {}
+            entries = []
+
+            def read_cpu(off):
+                cpu, count, cpu_lost = CPU_HEADER.unpack_from(data, off)
+                off += CPU_HEADER.size
+                lost[cpu] = cpu_lost
+                for _ in range(count):
+                    e = entry.unpack_from(data, off)
+                    entries.append(e if version >= 2 else e + (0,))
+                    off += entry.size
+                return off
+
+            if version >= 3:
+                # the output of other CPUs may come between the chunks
+                while True:
+                    end = data.find(END_MAGIC, off)
+                    if end < 0:
+                        raise ValueError("missing end marker")
+                    chunk = data.find(CHUNK_MAGIC, off, end)
+                    if 0 <= data.find(MAGIC, off, end) < (chunk if chunk >= 0 else end):
+                        raise ValueError("missing end marker")
+                    if chunk < 0:
+                        off = end
+                        break
+                    off = read_cpu(chunk + len(CHUNK_MAGIC))
+            else:
+                for _ in range(nr_cpus):
+                    off = read_cpu(off)
+            if data[off:off + 4] != END_MAGIC:
+                raise ValueError("missing end marker")
+        except (struct.error, ValueError) as e:
+            print("skipping a broken dump at offset %d: %s" % (pos, e), file=sys.stderr)
+            pos += len(MAGIC)
+            continue
+        yield cntfrq, lost, entries
+        pos = off + len(END_MAGIC)
+
+
+def to_us(cycles, cntfrq):
+    return cycles * 1000000.0 / cntfrq
+
+
+def print_timeline(entries, cntfrq):
+    if not entries:
+        return
+    t0 = entries[0][0]
+    print("%12s %3s %3s %4s %6s %16s %12s %10s %9s %s" % (
+        "time-us", "cpu", "vm", "vcpu", "reason", "elr", "ipa", "esr", "dur-us", "result"))
+    for (ts, elr, addr, esr, dur, vmid, vcpu, cpu, reason, result, _, _) in entries:
+        print("%12.1f %3d %3d %4d %6s %16x %12x %10x %9.2f %s" % (
+            to_us(ts - t0, cntfrq), cpu, vmid, vcpu, reason_name(reason), elr,
+            addr, esr, to_us(dur, cntfrq), RESULTS.get(result, str(result))))
+
+
+def is_mmio(reason, esr):
+    # data abort with a permission fault (DFSC 0b0011xx), see handle_mem_abort()
+    return REASONS.get(reason) == "DABT" and (esr & 0x3f) >> 2 == 0x3
+
+
+def print_mmio(entries, cntfrq):
+    """Prints every exit in the input format of tools/host/mmioreplay."""
+    print("# exit-us dur-us vm vcpu r|w|x [ipa value]")
+    for (ts, _, addr, esr, dur, vmid, vcpu, _, reason, _, _, value) in entries:
+        line = "%d %d %d %d" % (round(to_us(ts, cntfrq)), round(to_us(dur, cntfrq)),
+                                vmid, vcpu)
+        if is_mmio(reason, esr):
+            line += " %s %x %x" % ("w" if esr & (1 << 6) else "r", addr, value)
+        else:
+            line += " x"
+        print(line)
+
+
+def print_summary(entries, cntfrq, lost, burst_us):
+    stats = collections.defaultdict(list)
+    for e in entries:
+        stats[(e[5], e[8])].append(e[4])
+    print("%3s %6s %8s %10s %10s %10s %10s" % (
+        "vm", "reason", "count", "total-us", "mean-us", "max-us", "burst"))
+    burst_cycles = burst_us * cntfrq / 1000000.0
+    for (vmid, reason), durations in sorted(stats.items()):
+        # the largest number of exits within burst_us
+        times = sorted(e[0] for e in entries if e[5] == vmid and e[8] == reason)
+        burst, lo = 0, 0
+        for hi in range(len(times)):
+            while times[hi] - times[lo] > burst_cycles:
+                lo += 1
+            burst = max(burst, hi - lo + 1)
+        total = sum(durations)
+        print("%3d %6s %8d %10.1f %10.2f %10.2f %10d" % (
+            vmid, reason_name(reason), len(durations), to_us(total, cntfrq),
+            to_us(total / len(durations), cntfrq), to_us(max(durations), cntfrq), burst))
+    if entries:
+        span = to_us(entries[-1][0] - entries[0][0], cntfrq)
+        print("%d exits in %.1f us, burst: exits per %d us window" % (len(entries), span, burst_us))
+    lost_total = sum(lost.values())
+    if lost_total:
+        print("%d entries were overwritten before being dumped" % lost_total)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", help="captured UART output")
+    parser.add_argument("--summary", action="store_true", help="print the summary only")
+    parser.add_argument("--mmio", action="store_true",
+                        help="print the exits as an MMIO trace for tools/host/mmioreplay")
+    parser.add_argument("--burst-us", type=int, default=1000,
+                        help="window for counting bursts of exits (default: 1000)")
+    args = parser.parse_args()
+
+    with open(args.log, "rb") as f:
+        data = f.read()
+
+    found = False
+    for cntfrq, lost, entries in parse_dumps(data):
+        found = True
+        entries.sort(key=lambda e: e[0])
+        if args.mmio:
+            print_mmio(entries, cntfrq)
+            continue
+        if not args.summary:
+            print_timeline(entries, cntfrq)
+            print()
+        print_summary(entries, cntfrq, lost, args.burst_us)
+        print()
+    if not found:
+        sys.exit("no trace dump found in %s" % args.log)
+
+
+if __name__ == "__main__":
+    main()
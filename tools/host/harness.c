@@ -0,0 +1,344 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "fat32.h"
+#include "fifo.h"
+
+// Checks and benchmarks of fat32.c, fifo.c and the page allocator, built
+// for the host (see Makefile). The image is written by mkfat32.py.
+// Results are printed like the benchmark guest (example/bench):
+//   bench <name> iters=<n> min=<v> avg=<v> max=<v> unit=<unit>
+// so that its compare.py can be used on two runs.
+
+#define LOOKUP_ITERS 200
+#define LOAD_ROUNDS  3
+#define BIG_CHUNK    (64 * 1024)
+#define ALLOC_ITERS  1000000
+#define ALLOC_BURST  4096
+#define MIXED_SLOTS  512
+#define FIFO_ITERS   10000000
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    exit(1); \
+  } \
+} while (0)
+
+static struct fat32_fs fat32;
+static int nr_files;
+static unsigned char *filebuf;
+
+// keep in sync with mkfat32.py
+static unsigned char fill_byte(unsigned int seed, unsigned long off) {
+  return (seed * 7 + off * 13 + (off >> 9)) & 0xff;
+}
+
+static unsigned int guest_size(int i) {
+  return 100 + (i * 1237) % 16384;
+}
+
+static int check_fill(const unsigned char *buf, unsigned int seed,
+                      unsigned long off, unsigned long len) {
+  for (unsigned long i = 0; i < len; i++) {
+    if (buf[i] != fill_byte(seed, off + i))
+      return 0;
+  }
+  return 1;
+}
+
+// the largest blocks available tell whether freed pages merged back
+static int count_max_blocks(void) {
+  static paddr_t blocks[PAGING_PAGES >> (MAX_ORDER - 1)];
+  int n = 0;
+  paddr_t p;
+  while ((p = get_free_pages(MAX_ORDER - 1)) != 0)
+    blocks[n++] = p;
+  for (int i = 0; i < n; i++)
+    free_pages(blocks[i]);
+  return n;
+}
+
+static void check_alloc(void) {
+  static paddr_t pages[ALLOC_BURST * 4];
+  int nr_pages = sizeof(pages) / sizeof(pages[0]);
+  int max_blocks = count_max_blocks();
+  CHECK(max_blocks > 0);
+
+  // pages are distinct and inside the managed memory
+  for (int i = 0; i < nr_pages; i++) {
+    pages[i] = get_free_pages(0);
+    CHECK(pages[i] >= LOW_MEMORY && pages[i] < HIGH_MEMORY);
+    CHECK((pages[i] & (PAGE_SIZE - 1)) == 0);
+    *(unsigned long *)TO_VADDR(pages[i]) = i;
+  }
+  for (int i = 0; i < nr_pages; i++)
+    CHECK(*(unsigned long *)TO_VADDR(pages[i]) == (unsigned long)i);
+
+  // freeing every other page first must still merge everything back
+  for (int i = 0; i < nr_pages; i += 2)
+    free_pages(pages[i]);
+  for (int i = 1; i < nr_pages; i += 2)
+    free_pages(pages[i]);
+  CHECK(count_max_blocks() == max_blocks);
+
+  // blocks are aligned to their size and cleared by allocate_pages
+  for (int order = 0; order < MAX_ORDER; order++) {
+    unsigned char *p = allocate_pages(order);
+    CHECK(p != NULL);
+    CHECK(((paddr_t)p - LOW_MEMORY) % (PAGE_SIZE << order) == 0);
+    for (unsigned long i = 0; i < (PAGE_SIZE << order); i++)
+      CHECK(p[i] == 0);
+    memset(p, 0xa5, PAGE_SIZE << order);
+    free_pages((paddr_t)p);
+  }
+
+  // allocate_page clears pages coming back from the dirty list ...
+  unsigned char *p = allocate_page();
+  memset(p, 0xa5, PAGE_SIZE);
+  deallocate_page(p);
+  unsigned char *q = allocate_page();
+  CHECK(q == p);
+  for (int i = 0; i < PAGE_SIZE; i++)
+    CHECK(q[i] == 0);
+  memset(q, 0xa5, PAGE_SIZE);
+  deallocate_page(q);
+
+  // ... and the ones refilled into the zero pool
+  while (refill_zero_pool() > 0)
+    ;
+  for (int i = 0; i < ZERO_POOL_HIGH; i++) {
+    p = allocate_page();
+    for (int j = 0; j < PAGE_SIZE; j++)
+      CHECK(p[j] == 0);
+    pages[i] = (paddr_t)p;
+  }
+  for (int i = 0; i < ZERO_POOL_HIGH; i++)
+    deallocate_page((void *)pages[i]);
+
+  // pooled pages are given back when a large block is needed
+  CHECK(count_max_blocks() == max_blocks);
+  printf("check alloc ok (%d blocks of order %d)\n", max_blocks, MAX_ORDER - 1);
+}
+
+static void check_fifo(void) {
+  struct fifo *fifo = create_fifo();
+  unsigned long v;
+  CHECK(is_empty_fifo(fifo));
+  CHECK(dequeue_fifo(fifo, &v) < 0);
+
+  // fill it up twice to wrap around
+  for (int round = 0; round < 2; round++) {
+    unsigned long n = 0;
+    while (enqueue_fifo(fifo, round * 1000 + n) == 0)
+      n++;
+    CHECK(is_full_fifo(fifo));
+    CHECK(used_of_fifo(fifo) == (int)n);
+    for (unsigned long i = 0; i < n / 2; i++) {
+      CHECK(dequeue_fifo(fifo, &v) == 0);
+      CHECK(v == round * 1000 + i);
+    }
+    for (unsigned long i = 0; i < n / 2; i++)
+      CHECK(enqueue_fifo(fifo, round * 1000 + n + i) == 0);
+    for (unsigned long i = n / 2; i < n + n / 2; i++) {
+      CHECK(dequeue_fifo(fifo, &v) == 0);
+      CHECK(v == round * 1000 + i);
+    }
+    CHECK(is_empty_fifo(fifo));
+  }
+
+  enqueue_fifo(fifo, 1);
+  clear_fifo(fifo);
+  CHECK(is_empty_fifo(fifo) && used_of_fifo(fifo) == 0);
+  deallocate_page(fifo);
+  printf("check fifo ok\n");
+}
+
+static int load_file(const char *name, struct fat32_file *file) {
+  if (fat32_lookup(&fat32, name, file) < 0)
+    return -1;
+  return fat32_read(file, filebuf, 0, fat32_file_size(file));
+}
+
+static void check_fat32(void) {
+  struct fat32_file file;
+  char name[32];
+  int max_blocks = count_max_blocks();
+
+  CHECK(fat32_get_handle(&fat32) == 0);
+  int len = load_file("count.txt", &file);
+  CHECK(len > 0);
+  filebuf[len] = '\0';
+  nr_files = atoi((char *)filebuf);
+  CHECK(nr_files > 0);
+
+  for (int i = 0; i < nr_files; i++) {
+    sprintf(name, "guest-%04d.bin", i);
+    CHECK(load_file(name, &file) == (int)guest_size(i));
+    CHECK(!fat32_is_directory(&file));
+    CHECK(check_fill(filebuf, i, 0, guest_size(i)));
+  }
+  CHECK(fat32_lookup(&fat32, "guest-missing.bin", &file) < 0);
+  CHECK(fat32_lookup(&fat32, "guest-0000.bi", &file) < 0);
+
+  // reads at offsets that are not block aligned, and past the end
+  CHECK(fat32_lookup(&fat32, "big.bin", &file) == 0);
+  unsigned long size = fat32_file_size(&file);
+  CHECK(size > 3 * 512);
+  unsigned long offs[] = { 1, 511, 512, 513, 4095, 4097, size / 2 + 3 };
+  for (int i = 0; i < (int)(sizeof(offs) / sizeof(offs[0])); i++) {
+    CHECK(fat32_read(&file, filebuf, offs[i], 1500) == 1500);
+    CHECK(check_fill(filebuf, nr_files, offs[i], 1500));
+  }
+  CHECK(fat32_read(&file, filebuf, size - 100, 1000) == 100);
+  CHECK(check_fill(filebuf, nr_files, size - 100, 100));
+  CHECK(fat32_read(&file, filebuf, size, 1000) == 0);
+
+  // every block read is freed again
+  CHECK(count_max_blocks() == max_blocks);
+  printf("check fat32 ok (%d files)\n", nr_files);
+}
+
+static void bench_lookup(const char *bench, const char *name, int expect) {
+  struct fat32_file file;
+  struct result r;
+  reset_result(&r);
+  for (int i = 0; i < LOOKUP_ITERS; i++) {
+    unsigned long t0 = now_ns();
+    int ret = fat32_lookup(&fat32, name, &file);
+    add_sample(&r, now_ns() - t0);
+    CHECK((ret == 0) == expect);
+  }
+  report_result(bench, &r);
+}
+
+static void bench_fat32(void) {
+  struct fat32_file file;
+  char name[32];
+
+  bench_lookup("fat32_lookup_first", "guest-0000.bin", 1);
+  sprintf(name, "guest-%04d.bin", nr_files / 2);
+  bench_lookup("fat32_lookup_middle", name, 1);
+  sprintf(name, "guest-%04d.bin", nr_files - 1);
+  bench_lookup("fat32_lookup_last", name, 1);
+  bench_lookup("fat32_lookup_missing", "guest-missing.bin", 0);
+
+  unsigned long reads = host_sd_reads;
+  unsigned long t0 = now_ns();
+  for (int round = 0; round < LOAD_ROUNDS; round++) {
+    for (int i = 0; i < nr_files; i++) {
+      sprintf(name, "guest-%04d.bin", i);
+      CHECK(load_file(name, &file) == (int)guest_size(i));
+    }
+  }
+  unsigned long ns = now_ns() - t0;
+  report_rate("fat32_load", (unsigned long)LOAD_ROUNDS * nr_files, ns, "files/s");
+  printf("bench fat32_load_blocks iters=%d min=0 avg=%lu max=0 unit=blocks/file\n",
+         LOAD_ROUNDS * nr_files,
+         (host_sd_reads - reads) / ((unsigned long)LOAD_ROUNDS * nr_files));
+
+  CHECK(fat32_lookup(&fat32, "big.bin", &file) == 0);
+  unsigned long size = fat32_file_size(&file);
+  t0 = now_ns();
+  for (unsigned long off = 0; off < size; off += BIG_CHUNK)
+    CHECK(fat32_read(&file, filebuf, off, BIG_CHUNK) > 0);
+  report_rate("fat32_read_big", size / 1024, now_ns() - t0, "KB/s");
+}
+
+static void bench_alloc(void) {
+  static paddr_t pages[ALLOC_BURST];
+  static paddr_t slots[MIXED_SLOTS];
+
+  unsigned long t0 = now_ns();
+  for (int i = 0; i < ALLOC_ITERS; i++)
+    free_pages(get_free_pages(0));
+  report_rate("alloc_free_order0", 2UL * ALLOC_ITERS, now_ns() - t0, "ops/s");
+
+  int rounds = ALLOC_ITERS / ALLOC_BURST;
+  t0 = now_ns();
+  for (int round = 0; round < rounds; round++) {
+    for (int i = 0; i < ALLOC_BURST; i++)
+      pages[i] = get_free_pages(0);
+    for (int i = ALLOC_BURST - 1; i >= 0; i--)
+      free_pages(pages[i]);
+  }
+  report_rate("alloc_burst_order0", 2UL * rounds * ALLOC_BURST,
+              now_ns() - t0, "ops/s");
+
+  // a random mix of orders 0-4, half of the slots in use on average
+  unsigned int seed = 1;
+  t0 = now_ns();
+  for (int i = 0; i < ALLOC_ITERS; i++) {
+    seed = seed * 1103515245 + 12345;
+    int slot = (seed >> 8) % MIXED_SLOTS;
+    if (slots[slot]) {
+      free_pages(slots[slot]);
+      slots[slot] = 0;
+    } else {
+      slots[slot] = get_free_pages((seed >> 20) % 5);
+      CHECK(slots[slot] != 0);
+    }
+  }
+  report_rate("alloc_mixed_orders", ALLOC_ITERS, now_ns() - t0, "ops/s");
+  for (int i = 0; i < MIXED_SLOTS; i++) {
+    if (slots[i])
+      free_pages(slots[i]);
+  }
+
+  // cleared pages, through the dirty list
+  t0 = now_ns();
+  for (int i = 0; i < ALLOC_ITERS / 10; i++)
+    deallocate_page(allocate_page());
+  report_rate("allocate_page", 2UL * (ALLOC_ITERS / 10), now_ns() - t0, "ops/s");
+}
+
+static void bench_fifo(void) {
+  struct fifo *fifo = create_fifo();
+  unsigned long v;
+  unsigned long t0 = now_ns();
+  for (int i = 0; i < FIFO_ITERS; i++) {
+    enqueue_fifo(fifo, i);
+    dequeue_fifo(fifo, &v);
+  }
+  report_rate("fifo_enqueue_dequeue", 2UL * FIFO_ITERS, now_ns() - t0, "ops/s");
+  deallocate_page(fifo);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-c] image\n"
+                  "  -c  run the checks only\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int check_only = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    if (opt == 'c')
+      check_only = 1;
+    else
+      usage(argv[0]);
+  }
+  if (optind != argc - 1)
+    usage(argv[0]);
+
+  if (host_mem_init() < 0 || host_sd_open(argv[optind]) < 0)
+    return 1;
+  mm_init();
+  filebuf = malloc(BIG_CHUNK + 1);
+  CHECK(filebuf != NULL);
+
+  check_alloc();
+  check_fifo();
+  check_fat32();
+  if (check_only)
+    return 0;
+
+  bench_fat32();
+  bench_alloc();
+  bench_fifo();
+  return 0;
+}
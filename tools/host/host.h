@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include "mm.h"
+#include "spinlock.h"
+
+// the pages managed by the buddy allocator
+#define HOST_MEM_BASE LOW_MEMORY
+#define HOST_MEM_SIZE PAGING_MEMORY
+
+extern unsigned long host_sd_reads; // blocks read through sd_readblock
+
+int host_mem_init(void);
+int host_sd_open(const char *);
+
+// timing of the benchmarks, printed like the benchmark guest (example/bench):
+//   bench <name> iters=<n> min=<v> avg=<v> max=<v> unit=<unit>
+// so that its compare.py can be used on two runs (see timing.c)
+struct result {
+  unsigned long min;
+  unsigned long max;
+  unsigned long total;
+  unsigned long iters;
+};
+
+unsigned long now_ns(void);
+void reset_result(struct result *);
+void add_sample(struct result *, unsigned long);
+void report_result(const char *, const struct result *);
+void report_rate(const char *, unsigned long, unsigned long, const char *);
@@ -0,0 +1,14 @@
+#pragma once
+
+// replaces include/debug.h in the host build (no current task to report)
+#include "printf.h"
+
+void host_panic(void) __attribute__((noreturn));
+
+#define INFO(fmt, ...) printf("INFO[host]: " fmt "\n", ##__VA_ARGS__)
+#define WARN(fmt, ...) printf("WARN[host]: " fmt "\n", ##__VA_ARGS__)
+
+#define PANIC(fmt, ...) do { \
+  printf("!!! PANIC[host]: " fmt "\n", ##__VA_ARGS__); \
+  host_panic(); \
+} while(0)
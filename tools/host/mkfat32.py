@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Writes the FAT32 image used by the host harness (see Makefile).
+
+    ./mkfat32.py [--files N] [--big-size BYTES] sd.img
+
+Like the SD card of the hypervisor, the image has an MBR with a FAT32 (LBA)
+partition at sector 2048. The root directory holds
+
+    count.txt           number of the guest files, in decimal
+    guest-NNNN.bin      guest files of various sizes
+    big.bin             one large file
+
+every file except count.txt is filled by fill_byte() below, which the
+harness computes again to check what it reads. No mkfs.vfat or mtools
+are needed.
+"""
+
+import argparse
+import struct
+
+SECTOR = 512
+PART_LBA = 2048
+RESERVED = 32
+NR_FATS = 2
+MIN_CLUSTERS = 65526  # fewer clusters would make it FAT16
+END_OF_CHAIN = 0x0FFFFFFF
+
+
+def fill_byte(seed, off):
+    # keep in sync with fill_byte() of harness.c
+    return (seed * 7 + off * 13 + (off >> 9)) & 0xff
+
+
+def guest_size(i):
+    return 100 + (i * 1237) % 16384
+
+
+# fill_byte() of a 512 byte block only differs by a constant per block
+_ROW = bytes(fill_byte(0, off) for off in range(SECTOR))
+_SHIFT = [bytes((b + c) & 0xff for b in range(256)) for c in range(256)]
+
+
+def file_data(seed, size):
+    blocks = [_ROW.translate(_SHIFT[fill_byte(seed, b * SECTOR)])
+              for b in range((size + SECTOR - 1) // SECTOR)]
+    return b"".join(blocks)[:size]
+
+
+def lfn_entries(name, sfn):
+    chk = 0
+    for c in sfn:
+        chk = (((chk >> 1) | (chk << 7)) + c) & 0xff
+    chars = [ord(c) for c in name]
+    if len(chars) % 13:
+        chars.append(0)
+    while len(chars) % 13:
+        chars.append(0xffff)
+    parts = [chars[i:i + 13] for i in range(0, len(chars), 13)]
+    entries = []
+    for seq, part in enumerate(parts, 1):
+        ordinal = seq | (0x40 if seq == len(parts) else 0)
+        u = [struct.pack("<H", c) for c in part]
+        entries.append(bytes([ordinal]) + b"".join(u[0:5]) + bytes([0x0f, 0, chk])
+                       + b"".join(u[5:11]) + b"\0\0" + b"".join(u[11:13]))
+    # the entry of the last part comes first, right before it is the SFN
+    return list(reversed(entries))
+
+
+def sfn_entry(sfn, attr, cluster, size):
+    return struct.pack("<11sBBBHHHHHHHI", sfn, attr, 0, 0, 0, 0, 0,
+                       cluster >> 16, 0, 0, cluster & 0xffff, size)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("--files", type=int, default=2000, help="guest files")
+    parser.add_argument("--big-size", type=int, default=4 << 20, help="size of big.bin")
+    parser.add_argument("--cluster-sectors", type=int, default=1)
+    args = parser.parse_args()
+
+    spc = args.cluster_sectors
+    cluster_bytes = spc * SECTOR
+    files = [("count.txt", 0, ("%d\n" % args.files).encode())]
+    files += [("guest-%04d.bin" % i, i, guest_size(i)) for i in range(args.files)]
+    files.append(("big.bin", args.files, args.big_size))
+
+    # root directory: volume label, then LFN entries and SFN of every file
+    dents = [struct.pack("<11sB20x", b"RASPVISOR  ", 0x08)]
+    per_file = []
+    for n, (name, seed, data) in enumerate(files):
+        sfn = b"F%07d" % n + b"BIN"
+        per_file.append(sfn)
+        dents += lfn_entries(name, sfn)
+        dents.append(None)  # SFN, filled once the clusters are known
+    root_clusters = (len(dents) * 32 + cluster_bytes - 1) // cluster_bytes
+
+    def clusters_of(size):
+        return max(1, (size + cluster_bytes - 1) // cluster_bytes)
+
+    sizes = [len(d) if isinstance(d, bytes) else d for _, _, d in files]
+    used = root_clusters + sum(clusters_of(s) for s in sizes)
+    nr_clusters = max(MIN_CLUSTERS + 64, used + 64)
+    fat_sectors = ((nr_clusters + 2) * 4 + SECTOR - 1) // SECTOR
+    data_start = RESERVED + NR_FATS * fat_sectors
+    total = data_start + nr_clusters * spc
+
+    fat = [0] * (nr_clusters + 2)
+    fat[0], fat[1] = 0x0FFFFFF8, END_OF_CHAIN
+    next_cluster = 2
+
+    def allocate(count):
+        nonlocal next_cluster
+        first = next_cluster
+        for c in range(first, first + count - 1):
+            fat[c] = c + 1
+        fat[first + count - 1] = END_OF_CHAIN
+        next_cluster += count
+        return first
+
+    root = allocate(root_clusters)
+    placed = []
+    k = 0
+    for i, d in enumerate(dents):
+        if d is not None:
+            continue
+        name, seed, data = files[k]
+        size = sizes[k]
+        cluster = allocate(clusters_of(size))
+        dents[i] = sfn_entry(per_file[k], 0x20, cluster, size)
+        placed.append((cluster, seed, data))
+        k += 1
+
+    def lba(sector):
+        return (PART_LBA + sector) * SECTOR
+
+    def cluster_offset(c):
+        return lba(data_start + (c - 2) * spc)
+
+    with open(args.image, "wb") as f:
+        f.truncate(lba(total))
+
+        mbr = bytearray(SECTOR)
+        mbr[446:462] = struct.pack("<B3sB3sII", 0, b"\xfe\xff\xff", 0x0c,
+                                   b"\xfe\xff\xff", PART_LBA, total)
+        mbr[510:512] = b"\x55\xaa"
+        f.seek(0)
+        f.write(mbr)
+
+        boot = bytearray(SECTOR)
+        struct.pack_into("<3s8sHBHBHHBHHHIIIHHIHH12sBBBI11s8s", boot, 0,
+                         b"\xeb\x58\x90", b"RASPVSR ", SECTOR, spc, RESERVED,
+                         NR_FATS, 0, 0, 0xf8, 0, 63, 255, PART_LBA, total,
+                         fat_sectors, 0, 0, 2, 1, 6, bytes(12), 0x80, 0, 0x29,
+                         0x12345678, b"RASPVISOR  ", b"FAT32   ")
+        boot[510:512] = b"\x55\xaa"
+        fsinfo = bytearray(SECTOR)
+        struct.pack_into("<I", fsinfo, 0, 0x41615252)
+        struct.pack_into("<IIII", fsinfo, 484, 0x61417272,
+                         nr_clusters + 2 - next_cluster, next_cluster, 0)
+        struct.pack_into("<I", fsinfo, 508, 0xAA550000)
+        for s in (0, 6):
+            f.seek(lba(s))
+            f.write(boot)
+            f.write(fsinfo)
+
+        table = struct.pack("<%dI" % len(fat), *fat)
+        for n in range(NR_FATS):
+            f.seek(lba(RESERVED + n * fat_sectors))
+            f.write(table)
+
+        f.seek(cluster_offset(root))
+        f.write(b"".join(dents))
+
+        for cluster, seed, data in placed:
+            f.seek(cluster_offset(cluster))
+            f.write(data if isinstance(data, bytes) else file_data(seed, data))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Writes a synthetic MMIO trace for mmioreplay (see Makefile).
+
+    ./mkmmiotrace.py [--exits N] [--seed S] trace.txt
+
+The format is the one of `tools/decode_trace.py --mmio`, one VM exit per line:
+
+    <exit us> <duration us> <vm> <vcpu> r|w <ipa> <value>   emulated MMIO
+    <exit us> <duration us> <vm> <vcpu> x                   any other exit
+
+Two VMs behave like the guests of example/: VM 1 polls the Mini-UART and
+echoes what it receives (echo), VM 2 programs system timer C1 and prints
+on its interrupts (mini-os). Read values are what the guests would see on
+the board. Use a trace recorded on the board instead when one is at hand.
+"""
+
+import argparse
+import random
+
+PBASE = 0x3F000000
+IRQ_PENDING_1 = PBASE + 0xB204
+ENABLE_IRQS_1 = PBASE + 0xB210
+AUX_ENABLES = PBASE + 0x215004
+AUX_MU_IO_REG = PBASE + 0x215040
+AUX_MU_IER_REG = PBASE + 0x215044
+AUX_MU_IIR_REG = PBASE + 0x215048
+AUX_MU_LCR_REG = PBASE + 0x21504C
+AUX_MU_MCR_REG = PBASE + 0x215050
+AUX_MU_LSR_REG = PBASE + 0x215054
+AUX_MU_CNTL_REG = PBASE + 0x215060
+AUX_MU_BAUD_REG = PBASE + 0x215068
+TIMER_CS = PBASE + 0x3000
+TIMER_CLO = PBASE + 0x3004
+TIMER_C1 = PBASE + 0x3010
+
+LSR_TX_EMPTY = 0x60
+LSR_DATA = 0x61
+TIMER_INTERVAL = 200000  # us, like mini-os
+
+
+class Guest:
+    def __init__(self, vm, rng, start):
+        self.vm = vm
+        self.rng = rng
+        self.now = start
+        self.clo = 0  # system timer seen by the guest
+        self.lines = []
+
+    def exit(self, kind, addr=None, value=None, dur=None):
+        if dur is None:
+            dur = self.rng.randint(1, 3)
+        line = "%d %d %d 0 %s" % (self.now, dur, self.vm, kind)
+        if addr is not None:
+            line += " %x %x" % (addr, value)
+        self.lines.append((self.now, line))
+        step = dur + self.rng.randint(2, 20)
+        self.now += step
+        self.clo += step
+
+    def read(self, addr, value):
+        self.exit("r", addr, value)
+
+    def write(self, addr, value):
+        self.exit("w", addr, value)
+
+    def uart_init(self):
+        self.write(AUX_ENABLES, 1)
+        self.write(AUX_MU_CNTL_REG, 0)
+        self.write(AUX_MU_IER_REG, 0)
+        self.write(AUX_MU_LCR_REG, 3)
+        self.write(AUX_MU_MCR_REG, 0)
+        self.write(AUX_MU_BAUD_REG, 270)
+        self.write(AUX_MU_IIR_REG, 6)
+        self.write(AUX_MU_CNTL_REG, 3)
+
+    def puts(self, s):
+        for c in s:
+            self.read(AUX_MU_LSR_REG, LSR_TX_EMPTY)
+            self.write(AUX_MU_IO_REG, ord(c))
+
+
+def echo(rng, exits):
+    g = Guest(1, rng, 1000)
+    g.uart_init()
+    g.puts("Hello, world!\r\n")
+    while len(g.lines) < exits:
+        r = rng.random()
+        if r < 0.02:
+            c = rng.choice(b"abcdefghijklmnopqrstuvwxyz\r")
+            g.read(AUX_MU_LSR_REG, LSR_DATA)
+            g.read(AUX_MU_IO_REG, c)
+            g.puts(chr(c))
+        elif r < 0.05:
+            g.exit("x")  # interrupt taken by the hypervisor
+        else:
+            g.read(AUX_MU_LSR_REG, LSR_TX_EMPTY)
+    return g.lines
+
+
+def mini_os(rng, exits):
+    g = Guest(2, rng, 1500)
+    g.uart_init()
+    g.puts("mini-os\r\n")
+    g.read(TIMER_CLO, g.clo)
+    deadline = g.clo + TIMER_INTERVAL
+    g.write(TIMER_C1, deadline & 0xffffffff)
+    g.write(ENABLE_IRQS_1, 2)
+    ticks = 0
+    while len(g.lines) < exits:
+        if g.clo >= deadline:
+            g.exit("x")  # the virtual IRQ
+            g.read(IRQ_PENDING_1, 2)
+            deadline += TIMER_INTERVAL
+            g.write(TIMER_C1, deadline & 0xffffffff)
+            g.write(TIMER_CS, 2)
+            ticks += 1
+            g.puts("tick %d\r\n" % ticks)
+        elif rng.random() < 0.1:
+            g.exit("x")
+        else:
+            # WFI, blocked in the hypervisor until the next interrupt
+            g.exit("x", dur=min(rng.randint(100, 5000), max(deadline - g.clo, 1)))
+    return g.lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("trace")
+    parser.add_argument("--exits", type=int, default=100000, help="exits per VM")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    lines = echo(rng, args.exits) + mini_os(rng, args.exits)
+    lines.sort(key=lambda l: l[0])
+    with open(args.trace, "w") as f:
+        f.write("# exit-us dur-us vm vcpu r|w|x [ipa value]\n")
+        for _, line in lines:
+            f.write(line + "\n")
+
+
+if __name__ == "__main__":
+    main()
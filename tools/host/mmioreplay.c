@@ -0,0 +1,438 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "sched.h"
+#include "board.h"
+#include "bcm2837.h"
+#include "fifo.h"
+#include "peripherals/irq.h"
+#include "peripherals/mini_uart.h"
+#include "peripherals/timer.h"
+
+// Replays a trace of VM exits through src/bcm2837.c, built for the host
+// (see Makefile). The trace comes from `tools/decode_trace.py --mmio` or
+// mkmmiotrace.py. Each exit of vCPU 0 calls leaving_vm() at its time,
+// emulates the access if it is MMIO, and calls entering_vm() when the exit
+// ends, like vm_leaving_work() and vm_entering_work(). The system timer is
+// driven by the trace, so the replay is deterministic:
+//   - the time of each access by the register block is printed like the
+//     benchmark guest (bench <name> ... unit=ns)
+//   - the final state of each VM (registers, a hash of every value read,
+//     the console output) is compared with a golden file (-g), or written
+//     to it (-w)
+// Console input is not in the trace. When a recorded LSR/STAT read says a
+// byte was there, the byte of the next AUX_MU_IO read is put in the input
+// FIFO, and the output FIFO is drained on every exit.
+
+#define MAX_VMS       16
+#define DEFAULT_PASSES 20
+#define STATE_SIZE    (64 * 1024)
+
+#define BLOCK_INTCTRL  0
+#define BLOCK_AUX      1
+#define BLOCK_SYSTIMER 2
+#define BLOCK_OTHER    3
+#define BLOCK_EXIT     4 // leaving_vm() and entering_vm()
+#define NR_BLOCKS      5
+
+static const char *block_names[] = {
+  "mmio_intctrl", "mmio_aux", "mmio_systimer", "mmio_other", "mmio_exit",
+};
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    exit(1); \
+  } \
+} while (0)
+
+struct record {
+  unsigned long time;  // us
+  unsigned long duration;
+  unsigned long addr;
+  unsigned long value; // recorded value
+  int vm;
+  int vcpu;
+  char kind;           // r, w or x
+  int block;
+  int rx;              // byte to put in the input FIFO first, -1: none
+};
+
+struct replay_vm {
+  struct vm_struct vm;
+  struct task_struct vcpu0;
+  unsigned long reads;
+  unsigned long mismatches; // reads which differ from the recording
+  unsigned long read_hash;
+  unsigned long out_bytes;
+  unsigned long out_hash;
+  unsigned long timer;      // last set_vm_timer() of the VM
+};
+
+static struct record *records;
+static int nr_records;
+static struct replay_vm rvms[MAX_VMS];
+static struct replay_vm *running; // whose entering_vm() is called
+static unsigned long replay_us;
+static unsigned long timer_overhead;
+
+// ---- what bcm2837.c uses from the rest of the hypervisor ----
+
+unsigned long get_physical_timer_count(void) {
+  return replay_us;
+}
+
+void set_vm_timer(unsigned long deadline) {
+  if (running)
+    running->timer = deadline;
+}
+
+void set_task_page_notaccessable(struct task_struct *task, vaddr_t va) {
+}
+
+int boot_phase_begin(const char *name, int vmid) {
+  return -1;
+}
+
+void boot_phase_end(int phase, unsigned long bytes) {
+}
+
+// ---- trace ----
+
+#define FNV_OFFSET 0xcbf29ce484222325UL
+#define FNV_PRIME  0x100000001b3UL
+
+static unsigned long fnv(unsigned long hash, unsigned long v) {
+  for (int i = 0; i < 8; i++) {
+    hash ^= (v >> (i * 8)) & 0xff;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static int block_of(unsigned long addr) {
+  if (addr >= IRQ_BASIC_PENDING && addr <= DISABLE_BASIC_IRQS)
+    return BLOCK_INTCTRL;
+  if (addr >= AUX_IRQ && addr <= AUX_MU_BAUD_REG)
+    return BLOCK_AUX;
+  if (addr >= TIMER_CS && addr <= TIMER_C3)
+    return BLOCK_SYSTIMER;
+  return BLOCK_OTHER;
+}
+
+static void load_trace(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  int cap = 1024;
+  records = malloc(cap * sizeof(*records));
+  CHECK(records != NULL);
+  char line[256];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), f)) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    struct record r = { .rx = -1 };
+    int n = sscanf(line, "%lu %lu %d %d %c %lx %lx", &r.time, &r.duration,
+                   &r.vm, &r.vcpu, &r.kind, &r.addr, &r.value);
+    int ok = (n == 5 && r.kind == 'x') ||
+      (n == 7 && (r.kind == 'r' || r.kind == 'w'));
+    if (!ok || r.vm < 0 || r.vm >= MAX_VMS) {
+      fprintf(stderr, "%s:%d: bad record\n", path, lineno);
+      exit(1);
+    }
+    r.block = r.kind == 'x' ? BLOCK_EXIT : block_of(r.addr);
+    if (nr_records == cap) {
+      cap *= 2;
+      records = realloc(records, cap * sizeof(*records));
+      CHECK(records != NULL);
+    }
+    records[nr_records++] = r;
+  }
+  fclose(f);
+
+  // bytes received by the guests, from the reads of AUX_MU_IO
+  for (int i = 0; i < nr_records; i++) {
+    struct record *r = &records[i];
+    int dready = r->kind == 'r' && (r->value & 1) &&
+      (r->addr == AUX_MU_LSR_REG || r->addr == AUX_MU_STAT_REG);
+    if (!dready)
+      continue;
+    for (int j = i + 1; j < nr_records; j++) {
+      if (records[j].vm == r->vm && records[j].kind == 'r' &&
+          records[j].addr == AUX_MU_IO_REG) {
+        r->rx = records[j].value & 0xff;
+        break;
+      }
+    }
+  }
+}
+
+// ---- replay ----
+
+// cost of a now_ns() pair, taken off every sample
+static void calibrate(void) {
+  timer_overhead = ~0UL;
+  for (int i = 0; i < 100000; i++) {
+    unsigned long t0 = now_ns();
+    unsigned long t1 = now_ns();
+    if (t1 - t0 < timer_overhead)
+      timer_overhead = t1 - t0;
+  }
+}
+
+static unsigned long elapsed(unsigned long t0, unsigned long t1) {
+  return t1 - t0 > timer_overhead ? t1 - t0 - timer_overhead : 0;
+}
+
+static void drain_output(struct replay_vm *rvm) {
+  unsigned long val;
+  while (dequeue_fifo(rvm->vm.console.out_fifo, &val) == 0) {
+    rvm->out_bytes++;
+    rvm->out_hash = fnv(rvm->out_hash, val & 0xff);
+  }
+}
+
+static struct replay_vm *get_vm(int id) {
+  struct replay_vm *rvm = &rvms[id];
+  if (rvm->vm.board_ops)
+    return rvm;
+  memset(rvm, 0, sizeof(*rvm));
+  rvm->vm.id = id;
+  rvm->vm.board_ops = &bcm2837_board_ops;
+  rvm->vm.console.in_fifo = create_fifo();
+  rvm->vm.console.out_fifo = create_fifo();
+  CHECK(rvm->vm.console.in_fifo && rvm->vm.console.out_fifo);
+  rvm->vcpu0.vm = &rvm->vm;
+  rvm->vcpu0.vcpu_id = 0;
+  rvm->read_hash = FNV_OFFSET;
+  rvm->out_hash = FNV_OFFSET;
+  rvm->vm.board_ops->initialize(&rvm->vcpu0);
+  return rvm;
+}
+
+static void free_vms(void) {
+  for (int i = 0; i < MAX_VMS; i++) {
+    struct replay_vm *rvm = &rvms[i];
+    if (!rvm->vm.board_ops)
+      continue;
+    deallocate_page(rvm->vm.board_data);
+    deallocate_page(rvm->vm.console.in_fifo);
+    deallocate_page(rvm->vm.console.out_fifo);
+    rvm->vm.board_ops = NULL;
+  }
+}
+
+static void replay(struct result *results) {
+  for (int i = 0; i < nr_records; i++) {
+    struct record *r = &records[i];
+    replay_us = r->time;
+    struct replay_vm *rvm = get_vm(r->vm);
+    const struct board_ops *ops = rvm->vm.board_ops;
+    struct task_struct *tsk = &rvm->vcpu0;
+    unsigned long t0, t1, exit_ns = 0;
+
+    if (r->vcpu == 0) {
+      t0 = now_ns();
+      ops->leaving_vm(tsk);
+      t1 = now_ns();
+      exit_ns += elapsed(t0, t1);
+    }
+
+    if (r->kind == 'r') {
+      if (r->rx >= 0 && is_empty_fifo(rvm->vm.console.in_fifo))
+        enqueue_fifo(rvm->vm.console.in_fifo, r->rx);
+      t0 = now_ns();
+      unsigned long v = ops->mmio_read(tsk, r->addr);
+      t1 = now_ns();
+      add_sample(&results[r->block], elapsed(t0, t1));
+      rvm->reads++;
+      rvm->read_hash = fnv(rvm->read_hash, v);
+      if (v != r->value)
+        rvm->mismatches++;
+    } else if (r->kind == 'w') {
+      t0 = now_ns();
+      ops->mmio_write(tsk, r->addr, r->value);
+      t1 = now_ns();
+      add_sample(&results[r->block], elapsed(t0, t1));
+    }
+
+    if (r->vcpu == 0) {
+      replay_us = r->time + r->duration;
+      running = rvm;
+      t0 = now_ns();
+      ops->entering_vm(tsk);
+      t1 = now_ns();
+      running = NULL;
+      exit_ns += elapsed(t0, t1);
+      add_sample(&results[BLOCK_EXIT], exit_ns);
+    }
+    drain_output(rvm);
+  }
+}
+
+// ---- golden state ----
+
+static const struct {
+  const char *name;
+  unsigned long addr;
+} state_regs[] = {
+  // no side effects on read (not AUX_MU_IO_REG and AUX_MU_LSR_REG)
+  { "IRQ_BASIC_PENDING", IRQ_BASIC_PENDING },
+  { "IRQ_PENDING_1", IRQ_PENDING_1 },
+  { "IRQ_PENDING_2", IRQ_PENDING_2 },
+  { "FIQ_CONTROL", FIQ_CONTROL },
+  { "ENABLE_IRQS_1", ENABLE_IRQS_1 },
+  { "ENABLE_IRQS_2", ENABLE_IRQS_2 },
+  { "ENABLE_BASIC_IRQS", ENABLE_BASIC_IRQS },
+  { "AUX_IRQ", AUX_IRQ },
+  { "AUX_ENABLES", AUX_ENABLES },
+  { "AUX_MU_IER_REG", AUX_MU_IER_REG },
+  { "AUX_MU_IIR_REG", AUX_MU_IIR_REG },
+  { "AUX_MU_LCR_REG", AUX_MU_LCR_REG },
+  { "AUX_MU_MCR_REG", AUX_MU_MCR_REG },
+  { "AUX_MU_MSR_REG", AUX_MU_MSR_REG },
+  { "AUX_MU_SCRATCH", AUX_MU_SCRATCH },
+  { "AUX_MU_CNTL_REG", AUX_MU_CNTL_REG },
+  { "AUX_MU_STAT_REG", AUX_MU_STAT_REG },
+  { "AUX_MU_BAUD_REG", AUX_MU_BAUD_REG },
+  { "TIMER_CS", TIMER_CS },
+  { "TIMER_CLO", TIMER_CLO },
+  { "TIMER_CHI", TIMER_CHI },
+  { "TIMER_C0", TIMER_C0 },
+  { "TIMER_C1", TIMER_C1 },
+  { "TIMER_C2", TIMER_C2 },
+  { "TIMER_C3", TIMER_C3 },
+};
+
+#define NR_STATE_REGS (sizeof(state_regs) / sizeof(state_regs[0]))
+
+static int dump_state(char *buf, int size) {
+  int len = 0;
+#define OUT(...) len += snprintf(buf + len, size - len, __VA_ARGS__)
+  for (int i = 0; i < MAX_VMS; i++) {
+    struct replay_vm *rvm = &rvms[i];
+    if (!rvm->vm.board_ops)
+      continue;
+    const struct board_ops *ops = rvm->vm.board_ops;
+    struct task_struct *tsk = &rvm->vcpu0;
+    OUT("vm %d\n", i);
+    OUT("  reads %lu mismatches %lu hash %016lx\n", rvm->reads,
+        rvm->mismatches, rvm->read_hash);
+    OUT("  output %lu hash %016lx\n", rvm->out_bytes, rvm->out_hash);
+    OUT("  timer %lu next_event %lu irq %d fiq %d\n", rvm->timer,
+        ops->next_timer_event(tsk), ops->is_irq_asserted(tsk),
+        ops->is_fiq_asserted(tsk));
+    for (int j = 0; j < (int)NR_STATE_REGS; j++)
+      OUT("  %-18s %08lx\n", state_regs[j].name,
+          ops->mmio_read(tsk, state_regs[j].addr));
+  }
+#undef OUT
+  CHECK(len < size);
+  return len;
+}
+
+static int compare_golden(const char *path, const char *state) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char *golden = malloc(STATE_SIZE);
+  CHECK(golden != NULL);
+  size_t n = fread(golden, 1, STATE_SIZE - 1, f);
+  golden[n] = '\0';
+  fclose(f);
+
+  int ret = 0;
+  const char *g = golden, *s = state;
+  for (int lineno = 1; *g || *s; lineno++) {
+    int glen = strcspn(g, "\n"), slen = strcspn(s, "\n");
+    if (glen != slen || memcmp(g, s, glen) != 0) {
+      printf("%s:%d: expected \"%.*s\", got \"%.*s\"\n", path, lineno,
+             glen, g, slen, s);
+      ret = -1;
+    }
+    g += glen + (g[glen] == '\n');
+    s += slen + (s[slen] == '\n');
+  }
+  free(golden);
+  return ret;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-n passes] [-g golden | -w golden] trace\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int passes = DEFAULT_PASSES;
+  const char *golden = NULL;
+  int write_golden = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:g:w:")) != -1) {
+    switch (opt) {
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    case 'g':
+    case 'w':
+      golden = optarg;
+      write_golden = opt == 'w';
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || passes < 1)
+    usage(argv[0]);
+
+  if (host_mem_init() < 0)
+    return 1;
+  mm_init();
+  load_trace(argv[optind]);
+  CHECK(nr_records > 0);
+  calibrate();
+
+  // every pass starts from the initial state, and must end in the same one
+  struct result results[NR_BLOCKS];
+  for (int i = 0; i < NR_BLOCKS; i++)
+    reset_result(&results[i]);
+  char *state = malloc(STATE_SIZE), *first = malloc(STATE_SIZE);
+  CHECK(state && first);
+  for (int pass = 0; pass < passes; pass++) {
+    replay(results);
+    dump_state(state, STATE_SIZE);
+    if (pass == 0)
+      strcpy(first, state);
+    CHECK(strcmp(first, state) == 0);
+    free_vms();
+  }
+
+  for (int i = 0; i < NR_BLOCKS; i++)
+    report_result(block_names[i], &results[i]);
+
+  if (!golden)
+    return 0;
+  if (write_golden) {
+    FILE *f = fopen(golden, "w");
+    if (!f || fputs(state, f) < 0 || fclose(f) != 0) {
+      perror(golden);
+      return 1;
+    }
+    printf("wrote %s\n", golden);
+    return 0;
+  }
+  if (compare_golden(golden, state) < 0) {
+    printf("state differs from %s\n", golden);
+    return 1;
+  }
+  printf("state matches %s\n", golden);
+  return 0;
+}
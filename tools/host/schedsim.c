@@ -0,0 +1,573 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sched.h"
+#include "task.h"
+#include "board.h"
+#include "timer.h"
+#include "peripherals/timer.h"
+
+// Runs src/sched.c and src/timer.c on simulated CPUs and a fake clock,
+// with synthetic VMs instead of guests:
+//   cpu  always runnable
+//   wfi  a guest timer every <period> us, <burst> us of work each, WFI between
+//   irq  device interrupts every <interval> us on average (to vCPU 0 like the
+//        peripheral interrupts), <burst> us of work each, WFI between
+// Time advances in steps of 1 us. In each step every CPU takes its pending
+// interrupts (IPI, scheduler tick, and the system timer C3 and device
+// interrupts on CPU0) like handle_irq(), then runs its task for 1 us.
+// Halt polling (sync_exc.c) is not simulated: WFI blocks right away.
+
+#define CNTFRQ      19200000UL // physical counter of the BCM2837
+#define LAT_BUCKETS 100000     // latency histogram, 1 us each
+
+#define WL_CPU 0
+#define WL_WFI 1
+#define WL_IRQ 2
+
+static const char *wl_names[] = { "cpu", "wfi", "irq" };
+
+struct sim_vm {
+  struct vm_struct vm;
+  struct task_struct vcpus[NR_VCPUS];
+  int type;
+  unsigned long period;   // us (wfi)
+  unsigned long burst;    // us of work per event (wfi, irq)
+  unsigned long interval; // mean us between interrupts (irq)
+
+  unsigned long next_deadline; // guest timer (wfi), 0: none
+  unsigned long next_irq;      // next device interrupt (irq)
+  int irq_pending;
+  unsigned long event_time;    // oldest event not seen by the guest, 0: none
+  unsigned long busy_left;     // us of work left for the current event
+
+  unsigned long work;          // us run by the vCPUs
+  unsigned long events;
+  unsigned long switches;      // vCPUs switched in
+  unsigned long migrations;
+  unsigned long max_latency;
+  unsigned int lat_hist[LAT_BUCKETS + 1];
+  double entitled; // us of CPU time due by weight (cpu)
+};
+
+struct sim_cpu {
+  unsigned long tick_deadline; // CNTHP, in counter cycles, 0: stopped
+  int ipi;
+  unsigned long busy_until;    // in a context switch until then
+  unsigned long switches;
+  unsigned long idle;          // us in the idle task
+};
+
+static struct sim_vm sim_vms[NR_VMS];
+static int nr_sim_vms;
+static struct sim_cpu cpus[NR_CPUS];
+static struct task_struct *cpu_current[NR_CPUS];
+static int last_ran_cpu[NR_TASKS];
+static int nr_online = NR_CPUS;
+static int sim_cpu;
+static unsigned long sim_us = 1; // 0 means "none" for the scheduler
+static unsigned long switch_cost = 2; // us
+static unsigned int timer3_compare;
+static int timer3_armed;
+static unsigned int rand_state = 1;
+
+volatile int profile_enabled;
+
+// ---- what sched.c and timer.c use from the rest of the hypervisor ----
+
+struct task_struct *get_current(void) {
+  return cpu_current[sim_cpu];
+}
+
+void set_current(struct task_struct *p) {
+  cpu_current[sim_cpu] = p;
+}
+
+int smp_processor_id(void) {
+  return sim_cpu;
+}
+
+int is_cpu_online(int cpu) {
+  return cpu < nr_online;
+}
+
+void send_ipi(int cpu) {
+  cpus[cpu].ipi = 1;
+}
+
+unsigned long get_cntfrq(void) {
+  return CNTFRQ;
+}
+
+unsigned long get_cntpct(void) {
+  return sim_us * CNTFRQ / 1000000;
+}
+
+void set_hyp_timer(unsigned long cycles) {
+  cpus[sim_cpu].tick_deadline = get_cntpct() + cycles;
+}
+
+void stop_hyp_timer(void) {
+  cpus[sim_cpu].tick_deadline = 0;
+}
+
+// the system timer: 1 MHz counter and the C3 compare
+unsigned int get32(unsigned long addr) {
+  if (addr == TIMER_CLO)
+    return sim_us & 0xffffffff;
+  if (addr == TIMER_CHI)
+    return sim_us >> 32;
+  return 0;
+}
+
+void put32(unsigned long addr, unsigned int val) {
+  if (addr == TIMER_C3) {
+    timer3_compare = val;
+    timer3_armed = 1;
+  }
+}
+
+struct task_struct *cpu_switch_to(struct task_struct *prev,
+                                  struct task_struct *next) {
+  int cpu = sim_cpu;
+  cpus[cpu].switches++;
+  cpus[cpu].busy_until = sim_us + switch_cost;
+  if (next->vm) {
+    struct sim_vm *svm = (struct sim_vm *)next->vm;
+    svm->switches++;
+    if (last_ran_cpu[next->pid] >= 0 && last_ran_cpu[next->pid] != cpu)
+      svm->migrations++;
+    last_ran_cpu[next->pid] = cpu;
+  }
+  // next continues right away, as if it was resumed by cpu_switch_to
+  return prev;
+}
+
+struct pt_regs *task_pt_regs(struct task_struct *tsk) {
+  static struct pt_regs regs;
+  return &regs;
+}
+
+void save_sysregs(struct cpu_sysregs *regs) {}
+void restore_sysregs(struct cpu_sysregs *regs) {}
+void set_stage2_pgd(unsigned long pgd, unsigned long vmid) {}
+void flush_guest_tlb_local(void) {}
+void assert_virq(void) {}
+void clear_virq(void) {}
+void assert_vfiq(void) {}
+void clear_vfiq(void) {}
+void fpsimd_switch_to(struct task_struct *prev, struct task_struct *next) {}
+void pmu_switch_to(struct task_struct *prev, struct task_struct *next) {}
+int pmu_irq_pending(struct task_struct *tsk) { return 0; }
+void exit_stat_switch(struct task_struct *tsk) {}
+void exit_stat_entering(unsigned long begin, unsigned long end) {}
+void exit_stat_leaving(unsigned long begin, unsigned long end) {}
+void profile_tick(void) {}
+void trace_dump_tick(void) {}
+int trace_dump_pending(void) { return 0; }
+int is_uart_forwarded_vm(struct vm_struct *vm) { return 0; }
+void flush_vm_console(struct vm_struct *vm) {}
+void show_free_area_info(void) {}
+
+struct vm_struct *vms[NR_VMS];
+int nr_vms = 1; // VMID 0 is not used
+
+// ---- synthetic VMs ----
+
+static int sim_irq_asserted(struct task_struct *tsk) {
+  struct sim_vm *svm = (struct sim_vm *)tsk->vm;
+  return svm->irq_pending ||
+         (svm->next_deadline && sim_us >= svm->next_deadline);
+}
+
+static const struct board_ops sim_board_ops = {
+  .is_irq_asserted = sim_irq_asserted,
+};
+
+static double random_unit(void) {
+  rand_state = rand_state * 1103515245 + 12345;
+  return ((rand_state >> 8) + 1) / (double)(1 << 24);
+}
+
+static unsigned long random_interval(unsigned long mean) {
+  return 1 + (unsigned long)(-log(random_unit()) * mean);
+}
+
+static void raise_event(struct sim_vm *svm) {
+  if (!svm->event_time)
+    svm->event_time = sim_us;
+}
+
+// the part of handle_trap_wfx() for WFI on vCPU 0
+static void guest_wfi(struct sim_vm *svm) {
+  if (!has_pending_interrupt(current))
+    block_current_task(svm->next_deadline);
+}
+
+// 1 us of the guest on vCPU p
+static void run_guest(struct task_struct *p) {
+  struct sim_vm *svm = (struct sim_vm *)p->vm;
+  svm->work++;
+  if (svm->type == WL_CPU)
+    return;
+
+  if (svm->event_time) {
+    unsigned long lat = sim_us - svm->event_time;
+    svm->lat_hist[lat < LAT_BUCKETS ? lat : LAT_BUCKETS]++;
+    if (lat > svm->max_latency)
+      svm->max_latency = lat;
+    svm->event_time = 0;
+    svm->events++;
+  }
+  if (svm->busy_left == 0 && sim_irq_asserted(p)) {
+    // the guest acknowledges the interrupt and handles it
+    svm->busy_left = svm->burst;
+    svm->irq_pending = 0;
+    while (svm->next_deadline && svm->next_deadline <= sim_us)
+      svm->next_deadline += svm->period;
+  }
+  if (svm->busy_left > 0 && --svm->busy_left > 0)
+    return;
+  guest_wfi(svm);
+}
+
+static int parse_vm(char *spec) {
+  if (nr_sim_vms + 1 >= NR_VMS)
+    return -1;
+  struct sim_vm *svm = &sim_vms[nr_sim_vms];
+  char *opts = strchr(spec, ':');
+  if (opts)
+    *opts++ = '\0';
+  svm->type = -1;
+  for (int i = 0; i < 3; i++) {
+    if (strcmp(spec, wl_names[i]) == 0)
+      svm->type = i;
+  }
+  if (svm->type < 0)
+    return -1;
+
+  int weight = SCHED_DEFAULT_WEIGHT, cap = 0, nr_vcpus = 1;
+  unsigned long slice = SCHED_DEFAULT_TIMESLICE / 1000;
+  svm->period = 1000;
+  svm->burst = 100;
+  svm->interval = 2000;
+  for (char *kv = opts ? strtok(opts, ",") : NULL; kv; kv = strtok(NULL, ",")) {
+    char *v = strchr(kv, '=');
+    if (!v)
+      return -1;
+    *v++ = '\0';
+    unsigned long n = strtoul(v, NULL, 0);
+    if (strcmp(kv, "weight") == 0)
+      weight = n;
+    else if (strcmp(kv, "cap") == 0)
+      cap = n;
+    else if (strcmp(kv, "slice") == 0)
+      slice = n;
+    else if (strcmp(kv, "vcpus") == 0)
+      nr_vcpus = n;
+    else if (strcmp(kv, "period") == 0)
+      svm->period = n;
+    else if (strcmp(kv, "burst") == 0)
+      svm->burst = n;
+    else if (strcmp(kv, "interval") == 0)
+      svm->interval = n;
+    else
+      return -1;
+  }
+  // interrupts only go to vCPU 0 (see irq_board_ops())
+  if (nr_vcpus < 1 || nr_vcpus > NR_VCPUS ||
+      (svm->type != WL_CPU && nr_vcpus != 1) || svm->period == 0 ||
+      svm->burst == 0 || svm->interval == 0)
+    return -1;
+  if (set_vm_sched_params(&svm->vm, weight, cap, slice * 1000) < 0)
+    return -1;
+  svm->vm.nr_vcpus = nr_vcpus;
+  nr_sim_vms++;
+  return 0;
+}
+
+// like create_vm(), with all vCPUs started
+static void start_vms(void) {
+  sim_cpu = 0;
+  for (int i = 0; i < nr_sim_vms; i++) {
+    struct sim_vm *svm = &sim_vms[i];
+    struct vm_struct *vm = &svm->vm;
+    vm->name = wl_names[svm->type];
+    vm->board_ops = &sim_board_ops;
+    for (int cpu = 0; cpu < NR_CPUS; cpu++)
+      vm->last_vcpu_ran[cpu] = -1;
+    for (int j = 0; j < vm->nr_vcpus; j++) {
+      struct task_struct *p = &svm->vcpus[j];
+      p->vm = vm;
+      p->vcpu_id = j;
+      p->state = TASK_RUNNING;
+      p->last_cpu = -1;
+      p->sysregs_cpu = -1;
+      p->fpsimd_cpu = -1;
+      p->pid = nr_tasks++;
+      task[p->pid] = p;
+      vm->vcpus[j] = p;
+    }
+    if (svm->type == WL_WFI)
+      svm->next_deadline = sim_us + svm->period;
+    if (svm->type == WL_IRQ)
+      svm->next_irq = sim_us + random_interval(svm->interval);
+    vm->id = nr_vms;
+    vms[nr_vms++] = vm;
+    for (int j = 0; j < vm->nr_vcpus; j++)
+      wake_up_new_task(vm->vcpus[j]);
+  }
+}
+
+// device interrupts are routed to CPU0 (see mini_uart.c)
+static int device_irqs(void) {
+  int taken = 0;
+  for (int i = 0; i < nr_sim_vms; i++) {
+    struct sim_vm *svm = &sim_vms[i];
+    if (svm->next_deadline == sim_us)
+      raise_event(svm); // the guest timer, seen by the guest when it runs
+    if (svm->type != WL_IRQ || sim_us < svm->next_irq)
+      continue;
+    svm->next_irq = sim_us + random_interval(svm->interval);
+    svm->irq_pending = 1;
+    raise_event(svm);
+    wake_up_task(svm->vm.vcpus[0]);
+    taken = 1;
+  }
+  return taken;
+}
+
+static void step_cpu(int cpu, int first) {
+  struct sim_cpu *c = &cpus[cpu];
+  sim_cpu = cpu;
+
+  // handle_irq()
+  int irq = 0;
+  if (c->ipi) {
+    c->ipi = 0;
+    irq = 1;
+    update_sched_tick(need_sched_tick()); // handle_ipi()
+  }
+  if (c->tick_deadline && get_cntpct() >= c->tick_deadline) {
+    c->tick_deadline = 0;
+    irq = 1;
+    handle_sched_timer_irq();
+  }
+  if (cpu == 0) {
+    if (timer3_armed && timer3_compare == (sim_us & 0xffffffff)) {
+      timer3_armed = 0;
+      irq = 1;
+      handle_timer3_irq();
+    }
+    irq |= device_irqs();
+  }
+  if (irq)
+    check_preempt_wakeup();
+
+  struct task_struct *p = current;
+  if (!p->vm) {
+    // idle_loop(): schedule() once woken up by an interrupt
+    if (irq || first)
+      schedule();
+    p = current;
+  }
+  if (sim_us < c->busy_until)
+    return;
+  if (!p->vm) {
+    c->idle++;
+    return;
+  }
+  run_guest(p);
+}
+
+static unsigned long percentile(struct sim_vm *svm, int pct) {
+  unsigned long want = (svm->events * pct + 99) / 100, seen = 0;
+  if (!svm->events)
+    return 0;
+  for (unsigned long i = 0; i <= LAT_BUCKETS; i++) {
+    seen += svm->lat_hist[i];
+    if (seen >= want)
+      return i;
+  }
+  return LAT_BUCKETS;
+}
+
+// Shares the CPU time left by the wfi and irq VMs among the cpu VMs by
+// weight, limited by their vCPUs and cap (max-min fairness).
+static void compute_entitled(unsigned long duration_us) {
+  double left = (double)nr_online * duration_us;
+  int nr_open = 0;
+  for (int i = 0; i < nr_sim_vms; i++) {
+    struct sim_vm *svm = &sim_vms[i];
+    if (svm->type != WL_CPU)
+      left -= svm->work;
+    svm->entitled = -1;
+    nr_open += svm->type == WL_CPU;
+  }
+  while (nr_open > 0) {
+    double total_weight = 0;
+    for (int i = 0; i < nr_sim_vms; i++) {
+      if (sim_vms[i].type == WL_CPU && sim_vms[i].entitled < 0)
+        total_weight += sim_vms[i].vm.weight;
+    }
+    int limited = 0;
+    for (int i = 0; i < nr_sim_vms; i++) {
+      struct sim_vm *svm = &sim_vms[i];
+      if (svm->type != WL_CPU || svm->entitled >= 0)
+        continue;
+      double limit = (double)svm->vm.nr_vcpus * duration_us;
+      if (svm->vm.cap && svm->vm.cap / 100.0 * duration_us < limit)
+        limit = svm->vm.cap / 100.0 * duration_us;
+      if (left * svm->vm.weight / total_weight > limit) {
+        svm->entitled = limit;
+        left -= limit;
+        nr_open--;
+        limited = 1;
+      }
+    }
+    if (limited)
+      continue;
+    for (int i = 0; i < nr_sim_vms; i++) {
+      struct sim_vm *svm = &sim_vms[i];
+      if (svm->type == WL_CPU && svm->entitled < 0)
+        svm->entitled = left * svm->vm.weight / total_weight;
+    }
+    break;
+  }
+}
+
+// Returns Jain's fairness index of the cpu VMs, 1.0 if there is only one.
+static double report(unsigned long duration_us) {
+  unsigned long total_work = 0;
+  for (int i = 0; i < nr_sim_vms; i++)
+    total_work += sim_vms[i].work;
+  compute_entitled(duration_us);
+
+  printf("%2s %4s %5s %6s %4s %8s %7s %7s %6s %8s %6s %7s %7s %7s %7s %7s %8s\n",
+         "vm", "type", "vcpus", "weight", "cap", "slice-ms", "cpu-%", "share-%",
+         "fair-%", "switches", "migr", "events", "p50-us", "p90-us", "p99-us", "max-us",
+         "sched-us");
+  for (int i = 0; i < nr_sim_vms; i++) {
+    struct sim_vm *svm = &sim_vms[i];
+    struct vm_struct *vm = &svm->vm;
+    unsigned long sched_us = vm->wakeup_count ?
+      cntpct_to_ns(vm->wakeup_latency_total / vm->wakeup_count) / 1000 : 0;
+    char fair[16] = "-";
+    if (svm->type == WL_CPU && svm->entitled > 0)
+      snprintf(fair, sizeof(fair), "%.1f", 100.0 * svm->work / svm->entitled);
+    printf("%2d %4s %5d %6d %4d %8lu %7.2f %7.2f %6s %8lu %6lu %7lu %7lu %7lu %7lu %7lu %8lu\n",
+           vm->id, wl_names[svm->type], vm->nr_vcpus, vm->weight, vm->cap,
+           vm->timeslice / 1000, 100.0 * svm->work / duration_us,
+           total_work ? 100.0 * svm->work / total_work : 0.0, fair,
+           svm->switches, svm->migrations, svm->events,
+           percentile(svm, 50), percentile(svm, 90), percentile(svm, 99),
+           svm->max_latency, sched_us);
+  }
+
+  // Jain's index of the CPU time received / due of the cpu VMs
+  double sum = 0, sum_sq = 0;
+  int n = 0;
+  for (int i = 0; i < nr_sim_vms; i++) {
+    struct sim_vm *svm = &sim_vms[i];
+    if (svm->type != WL_CPU || svm->entitled <= 0)
+      continue;
+    double x = svm->work / svm->entitled;
+    sum += x;
+    sum_sq += x * x;
+    n++;
+  }
+  double fairness = n > 1 ? sum * sum / (n * sum_sq) : 1.0;
+  if (n > 1)
+    printf("fairness %.4f (Jain's index of fair-%% of %d cpu VMs)\n",
+           fairness, n);
+
+  unsigned long switches = 0;
+  for (int cpu = 0; cpu < nr_online; cpu++) {
+    printf("cpu%d switches %lu idle %.2f%%\n", cpu, cpus[cpu].switches,
+           100.0 * cpus[cpu].idle / duration_us);
+    switches += cpus[cpu].switches;
+  }
+  printf("switches %lu (%.1f/s)\n", switches, switches * 1e6 / duration_us);
+  return fairness;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-c cpus] [-t ms] [-s switch-us] [-r seed] [-f min] [-l] vm...\n"
+          "  vm: cpu|wfi|irq[:key=value,...]\n"
+          "      weight, cap (%%), slice (ms), vcpus (cpu only),\n"
+          "      period (us, wfi), burst (us, wfi/irq), interval (us, irq)\n"
+          "  -f  fail if the fairness index is below min\n"
+          "  -l  show the task list of the scheduler at the end\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned long duration_ms = 10000;
+  double min_fairness = 0;
+  int show_tasks = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:t:s:r:f:l")) != -1) {
+    switch (opt) {
+    case 'c':
+      nr_online = atoi(optarg);
+      break;
+    case 't':
+      duration_ms = strtoul(optarg, NULL, 0);
+      break;
+    case 's':
+      switch_cost = strtoul(optarg, NULL, 0);
+      break;
+    case 'r':
+      rand_state = strtoul(optarg, NULL, 0);
+      break;
+    case 'f':
+      min_fairness = strtod(optarg, NULL);
+      break;
+    case 'l':
+      show_tasks = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (nr_online < 1 || nr_online > NR_CPUS || optind == argc)
+    usage(argv[0]);
+  for (int i = optind; i < argc; i++) {
+    if (parse_vm(argv[i]) < 0) {
+      fprintf(stderr, "bad vm: %s\n", argv[i]);
+      usage(argv[0]);
+    }
+  }
+
+  for (int i = 0; i < NR_TASKS; i++)
+    last_ran_cpu[i] = -1;
+  sched_init();
+  timer_init();
+  for (int cpu = 1; cpu < NR_CPUS; cpu++) {
+    sim_cpu = cpu;
+    init_idle_task(cpu);
+  }
+  start_vms();
+
+  unsigned long start = sim_us, end = sim_us + duration_ms * 1000;
+  for (int first = 1; sim_us < end; sim_us++, first = 0) {
+    for (int cpu = 0; cpu < nr_online; cpu++)
+      step_cpu(cpu, first);
+  }
+
+  printf("%d cpus, %lu ms, switch cost %lu us\n", nr_online, duration_ms,
+         switch_cost);
+  double fairness = report(end - start);
+  if (show_tasks) {
+    sim_cpu = 0;
+    show_task_list();
+  }
+  if (fairness < min_fairness) {
+    fprintf(stderr, "fairness %.4f is below %.4f\n", fairness, min_fairness);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host.h"
+
+// Everything the hypervisor modules of the host build need besides libc.
+// Physical memory is mapped at the same addresses as on the board, so the
+// identity mapping of mm.h (TO_VADDR) holds.
+
+static unsigned char *sd_image;
+static unsigned long sd_blocks;
+unsigned long host_sd_reads;
+
+int host_mem_init(void) {
+  void *p = mmap((void *)HOST_MEM_BASE, HOST_MEM_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+                 -1, 0);
+  if (p != (void *)HOST_MEM_BASE) {
+    perror("mmap of the physical memory");
+    return -1;
+  }
+  return 0;
+}
+
+int host_sd_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  sd_image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (sd_image == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  sd_blocks = st.st_size / 512;
+  return 0;
+}
+
+// same contract as src/sd.c: returns the bytes read, 0 on error
+int sd_readblock(unsigned int lba, unsigned char *buffer, unsigned int num) {
+  if (num == 0)
+    num = 1;
+  if (lba + num > sd_blocks)
+    return 0;
+  memcpy(buffer, sd_image + (unsigned long)lba * 512, num * 512);
+  host_sd_reads += num;
+  return num * 512;
+}
+
+void memzero(void *p, size_t n) {
+  memset(p, 0, n);
+}
+
+// uncontended, like a lock taken by a single CPU
+void spin_lock(spinlock_t *lock) {
+  while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+void spin_unlock(spinlock_t *lock) {
+  __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+unsigned long spin_lock_irqsave(spinlock_t *lock) {
+  spin_lock(lock);
+  return 0;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags) {
+  spin_unlock(lock);
+}
+
+void tfp_printf(char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  vprintf(fmt, va);
+  va_end(va);
+}
+
+void host_panic(void) {
+  abort();
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+
+// Timing helpers of harness.c and mmioreplay.c.
+
+unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void reset_result(struct result *r) {
+  memset(r, 0, sizeof(*r));
+}
+
+void add_sample(struct result *r, unsigned long v) {
+  if (r->iters == 0 || v < r->min)
+    r->min = v;
+  if (v > r->max)
+    r->max = v;
+  r->total += v;
+  r->iters++;
+}
+
+// in ns, nothing if there is no sample
+void report_result(const char *name, const struct result *r) {
+  if (r->iters == 0)
+    return;
+  printf("bench %s iters=%lu min=%lu avg=%lu max=%lu unit=ns\n", name,
+         r->iters, r->min, r->total / r->iters, r->max);
+}
+
+// count operations in ns, as operations per second
+void report_rate(const char *name, unsigned long count, unsigned long ns,
+                 const char *unit) {
+  printf("bench %s iters=%lu min=0 avg=%lu max=0 unit=%s\n", name, count,
+         (unsigned long)((double)count * 1000000000.0 / ns), unit);
+}
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Symbolize the guest PC samples printed by raspvisor (? + r on the console).
+
+Capture the UART output to a file, then give the ELF of each guest:
+
+    tools/symbolize_profile.py --elf 1=kernel.elf --elf 2=app.elf uart.log
+    tools/symbolize_profile.py --elf kernel.elf uart.log   # for all VMs
+    tools/symbolize_profile.py --pcs --elf kernel.elf uart.log
+
+Samples are grouped by function. With --pcs, every sampled PC is listed
+with ELR_EL1 (the return address of the exception being handled, for
+samples taken at EL1). The last dump of each VM in the file is used.
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+class Symbols:
+    def __init__(self, elf, nm):
+        out = subprocess.run([nm, "-n", "--defined-only", elf],
+                             check=True, capture_output=True, text=True).stdout
+        self.addrs = []
+        self.names = []
+        for line in out.splitlines():
+            fields = line.split()
+            if len(fields) != 3 or fields[1] not in "tTwW":
+                continue
+            self.addrs.append(int(fields[0], 16))
+            self.names.append(fields[2])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return None, 0
+        return self.names[i], addr - self.addrs[i]
+
+
+def parse_profiles(lines):
+    """Returns {vm: (name, samples, dropped, period, [(pc, el, count, elr)])}."""
+    profiles = {}
+    current = None
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 6 and fields[0] == "profile":
+            vm = int(fields[1])
+            current = (fields[2], int(fields[3]), int(fields[4]), int(fields[5]), [])
+            profiles[vm] = current
+        elif fields == ["end"]:
+            current = None
+        elif current is not None and len(fields) == 4:
+            # lines printed by other CPUs meanwhile are skipped
+            try:
+                pc, el, count, elr = (int(fields[0], 16), int(fields[1]),
+                                      int(fields[2]), int(fields[3], 16))
+            except ValueError:
+                continue
+            current[4].append((pc, el, count, elr))
+    return profiles
+
+
+def describe(symbols, addr):
+    if symbols is None:
+        return "%x" % addr
+    name, off = symbols.lookup(addr)
+    if name is None:
+        return "%x" % addr
+    return "%s+0x%x" % (name, off)
+
+
+def report(vm, profile, symbols, top, pcs):
+    name, nr_samples, dropped, period, samples = profile
+    print("vm %d (%s): %d samples every %d ms, %d dropped"
+          % (vm, name, nr_samples, period, dropped))
+    total = sum(s[2] for s in samples) or 1
+    funcs = collections.Counter()
+    for pc, el, count, _ in samples:
+        func = symbols.lookup(pc)[0] if symbols else None
+        funcs[(func or "%x" % pc, el)] += count
+    print("  %7s %6s %2s  %s" % ("samples", "%", "el", "function"))
+    for (func, el), count in funcs.most_common(top):
+        print("  %7d %6.2f %2d  %s" % (count, 100.0 * count / total, el, func))
+    if pcs:
+        print("  %7s %2s  %-40s %s" % ("samples", "el", "pc", "elr_el1"))
+        for pc, el, count, elr in sorted(samples, key=lambda s: -s[2]):
+            print("  %7d %2d  %-40s %s" % (count, el, describe(symbols, pc),
+                                           describe(symbols, elr) if elr else "-"))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", help="captured UART output")
+    parser.add_argument("--elf", action="append", default=[],
+                        help="[VM=]ELF of a guest (without VM=, for all VMs)")
+    parser.add_argument("--nm", default="aarch64-linux-gnu-nm")
+    parser.add_argument("--top", type=int, default=20, help="functions per VM")
+    parser.add_argument("--pcs", action="store_true", help="list every sampled PC")
+    args = parser.parse_args()
+
+    default_elf = None
+    elfs = {}
+    for spec in args.elf:
+        vm, sep, path = spec.partition("=")
+        if sep and vm.isdigit():
+            elfs[int(vm)] = path
+        else:
+            default_elf = spec
+
+    with open(args.log, errors="replace") as f:
+        profiles = parse_profiles(f)
+    if not profiles:
+        sys.exit("no profile found in %s" % args.log)
+
+    cache = {}
+    for vm in sorted(profiles):
+        elf = elfs.get(vm, default_elf)
+        if elf and elf not in cache:
+            cache[elf] = Symbols(elf, args.nm)
+        report(vm, profiles[vm], cache.get(elf), args.top, args.pcs)
+
+
+if __name__ == "__main__":
+    main()